@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  alignas(max_align_t) char data[];
+};
+
+
+struct arena command_arena;
+
+
+void *arena_alloc(struct arena *arena, size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+  struct arena_block *block = arena->blocks;
+  if (block == NULL || block->size - block->used < size) {
+    // start a new block, large enough for oversized requests.
+    size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(*block) + block_size);
+    if (block == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    block->size = block_size;
+    block->used = 0;
+
+    // keep the current block first if it has more space left, so a
+    // single large request doesn't waste it.
+    if (arena->blocks != NULL && block_size == size) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      block->next = arena->blocks;
+      arena->blocks = block;
+    }
+  }
+
+  void *memory = &block->data[block->used];
+  block->used += size;
+  return memory;
+}
+
+
+char *arena_strndup(struct arena *arena, const char *s, size_t n) {
+  size_t len = strnlen(s, n);
+  char *copy = arena_alloc(arena, len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+
+char *arena_strdup(struct arena *arena, const char *s) {
+  return arena_strndup(arena, s, strlen(s));
+}
+
+
+void arena_reset(struct arena *arena) {
+  // keep one block of the usual size, oversized ones are freed so a
+  // huge command line doesn't pin its memory.
+  struct arena_block *kept = NULL;
+  struct arena_block *block = arena->blocks;
+  while (block != NULL) {
+    struct arena_block *next = block->next;
+    if (kept == NULL && block->size == ARENA_BLOCK_SIZE) {
+      kept = block;
+      kept->used = 0;
+      kept->next = NULL;
+    } else {
+      free(block);
+    }
+    block = next;
+  }
+  arena->blocks = kept;
+}
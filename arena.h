@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator, memory is handed out from large blocks and is
+// only given back all at once by 'arena_reset'.
+struct arena {
+  struct arena_block *blocks;
+};
+
+
+// The arena for everything allocated while running one command line,
+// it's reset after the command line finishes.
+extern struct arena command_arena;
+
+
+// Returns 'size' bytes of memory from the arena, suitably aligned for
+// any type.
+void *arena_alloc(struct arena *arena, size_t size);
+
+
+// Returns a NUL-terminated copy of at most 'n' characters of 's'
+// allocated from the arena.
+char *arena_strndup(struct arena *arena, const char *s, size_t n);
+
+
+// Returns a copy of 's' allocated from the arena.
+char *arena_strdup(struct arena *arena, const char *s);
+
+
+// Free everything allocated from the arena, its first block is kept
+// for reuse.
+void arena_reset(struct arena *arena);
+
+#endif
@@ -0,0 +1,411 @@
+//
+// Microbenchmarks of the core routines of the shell, linked directly
+// against its objects, run by 'make bench'.
+//
+// Every benchmark repeats its operation in batches long enough to time,
+// and prints the mean time per operation, the 50th, 90th and 99th
+// percentiles of the time per operation of the batches, and the heap
+// allocations per operation made by the shell's code, counted by
+// wrapping malloc and friends at link time.
+//
+// The corpora are made in a temporary directory: a long command line,
+// a directory of BENCH_FILES files (100000 by default), a tree for
+// '**', a PATH of 256 directories and a history of BENCH_HISTORY lines
+// (1000000 by default), which suggestions are made from too.
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../arena.h"
+#include "../parser.h"
+#include "../globbing.h"
+#include "../hash.h"
+#include "../history.h"
+#include "../suggest.h"
+#include "../simsh.h"
+
+// the samples taken of every benchmark, and the shortest batch timed.
+#define NSAMPLES 200
+#define MIN_BATCH_NS 20000
+#define PATH_DIRECTORIES 256
+
+
+// heap allocations made since the start, by any thread.
+static uint64_t nallocations = 0;
+
+// the corpora.
+static char corpus[PATH_MAX];
+static char *long_line;
+static char **long_line_tokens;
+static char **plain_words;
+static char *glob_tokens[3];
+static char *globstar_tokens[3];
+static char **path;
+static struct arena bench_arena = { NULL };
+static FILE *results;
+
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+static uint64_t now();
+static void run_benchmark(char *name, void (*operation)(void), bool reset_arena);
+static int compare_doubles(const void *a, const void *b);
+static void make_corpora();
+static void make_files(char *directory, int nfiles, char *suffix);
+static void remove_corpora();
+static long get_count(char *variable, long default_count);
+
+static void bench_tokenize();
+static void bench_parse();
+static void bench_globbing_plain();
+static void bench_globbing();
+static void bench_globstar();
+static void bench_lookup_hashed();
+static void bench_lookup_search();
+static void bench_lookup_missing();
+static void bench_history_entry();
+static void bench_history_search();
+static void bench_history_append();
+static void bench_suggest();
+
+
+int main() {
+  make_corpora();
+  fprintf(results, "%-30s %12s %12s %12s %12s %10s\n", "benchmark", "ns/op",
+          "p50", "p90", "p99", "allocs/op");
+
+  run_benchmark("tokenize (long line)", bench_tokenize, true);
+  run_benchmark("parse_command (long line)", bench_parse, true);
+  run_benchmark("globbing (no patterns)", bench_globbing_plain, true);
+  run_benchmark("globbing (huge directory)", bench_globbing, true);
+  run_benchmark("globbing (** tree)", bench_globstar, true);
+
+  char executable_path[PATH_MAX];
+  executable_exists(path, "target", executable_path);
+  run_benchmark("executable_exists (hashed)", bench_lookup_hashed, false);
+  run_benchmark("executable_exists (search)", bench_lookup_search, false);
+  run_benchmark("executable_exists (missing)", bench_lookup_missing, false);
+
+  // the history is read once, the first time it's used.
+  uint64_t started = now();
+  int nlines = get_nlines();
+  fprintf(results, "%-30s %12.0f %12s %12s %12s %10s  (%d lines)\n",
+          "history load (once)", (double) (now() - started), "-", "-", "-", "-",
+          nlines);
+  run_benchmark("get_history_entry", bench_history_entry, false);
+  run_benchmark("search_history (prefix)", bench_history_search, false);
+  run_benchmark("write_to_history + flush", bench_history_append, true);
+
+  // the index of suggestions is built the first time one is asked for.
+  int len;
+  started = now();
+  suggest("g", 1, &len);
+  fprintf(results, "%-30s %12.0f %12s %12s %12s %10s\n",
+          "suggestion index (once)", (double) (now() - started), "-", "-", "-",
+          "-");
+  run_benchmark("suggest (prefix)", bench_suggest, false);
+
+  remove_corpora();
+  return 0;
+}
+
+
+void *__wrap_malloc(size_t size) {
+  __atomic_fetch_add(&nallocations, 1, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+
+void *__wrap_calloc(size_t n, size_t size) {
+  __atomic_fetch_add(&nallocations, 1, __ATOMIC_RELAXED);
+  return __real_calloc(n, size);
+}
+
+
+void *__wrap_realloc(void *p, size_t size) {
+  __atomic_fetch_add(&nallocations, 1, __ATOMIC_RELAXED);
+  return __real_realloc(p, size);
+}
+
+
+char *__wrap_strdup(const char *s) {
+  __atomic_fetch_add(&nallocations, 1, __ATOMIC_RELAXED);
+  return __real_strdup(s);
+}
+
+
+char *__wrap_strndup(const char *s, size_t n) {
+  __atomic_fetch_add(&nallocations, 1, __ATOMIC_RELAXED);
+  return __real_strndup(s, n);
+}
+
+
+static uint64_t now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+// Time 'operation' and print its results. The command arena is reset
+// after every run of it if 'reset_arena' is true, as the shell does
+// after every line.
+static void run_benchmark(char *name, void (*operation)(void), bool reset_arena) {
+  // the batch doubles until it takes long enough to time.
+  long batch = 1;
+  for (;;) {
+    uint64_t started = now();
+    for (long i = 0; i < batch; i++) {
+      operation();
+      if (reset_arena) {
+        arena_reset(&command_arena);
+      }
+    }
+    if (now() - started >= MIN_BATCH_NS || batch >= (1 << 24)) {
+      break;
+    }
+    batch *= 2;
+  }
+
+  double samples[NSAMPLES];
+  double total = 0;
+  uint64_t allocations = __atomic_load_n(&nallocations, __ATOMIC_RELAXED);
+  for (int i = 0; i < NSAMPLES; i++) {
+    uint64_t started = now();
+    for (long j = 0; j < batch; j++) {
+      operation();
+      if (reset_arena) {
+        arena_reset(&command_arena);
+      }
+    }
+    samples[i] = (double) (now() - started) / batch;
+    total += samples[i];
+  }
+  allocations = __atomic_load_n(&nallocations, __ATOMIC_RELAXED) - allocations;
+
+  qsort(samples, NSAMPLES, sizeof(double), compare_doubles);
+  fprintf(results, "%-30s %12.1f %12.1f %12.1f %12.1f %10.2f\n", name,
+          total / NSAMPLES, samples[NSAMPLES / 2], samples[NSAMPLES * 90 / 100],
+          samples[NSAMPLES * 99 / 100],
+          (double) allocations / (NSAMPLES * batch));
+  fflush(results);
+}
+
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+
+static void bench_tokenize() {
+  tokenize(&command_arena, long_line, " \t\r\n", "!><|;&");
+}
+
+
+static void bench_parse() {
+  parse_command(long_line_tokens);
+}
+
+
+static void bench_globbing_plain() {
+  globbing(plain_words);
+}
+
+
+static void bench_globbing() {
+  globbing(glob_tokens);
+}
+
+
+static void bench_globstar() {
+  globbing(globstar_tokens);
+}
+
+
+static void bench_lookup_hashed() {
+  char executable_path[PATH_MAX];
+  executable_exists(path, "target", executable_path);
+}
+
+
+// every directory of the path is searched.
+static void bench_lookup_search() {
+  char executable_path[PATH_MAX];
+  hash_remove("target");
+  executable_exists(path, "target", executable_path);
+}
+
+
+static void bench_lookup_missing() {
+  char executable_path[PATH_MAX];
+  hash_remove("missing");
+  executable_exists(path, "missing", executable_path);
+}
+
+
+static void bench_history_entry() {
+  static unsigned int seed = 1;
+  int len;
+  get_history_entry(rand_r(&seed) % get_nlines(), &len);
+}
+
+
+static void bench_history_search() {
+  // the matches are printed, to nowhere.
+  search_history("make -j8 target99999", true);
+}
+
+
+static void bench_history_append() {
+  static char *words[] = { "git", "commit", "-m", "message", NULL };
+  write_to_history(words);
+  flush_history();
+}
+
+
+static void bench_suggest() {
+  int len;
+  suggest("make -j8 target9", 16, &len);
+}
+
+
+// Make every corpus in a new temporary directory.
+static void make_corpora() {
+  strcpy(corpus, "/tmp/simsh-bench-XXXXXX");
+  if (mkdtemp(corpus) == NULL) {
+    perror("mkdtemp");
+    exit(1);
+  }
+  char name[PATH_MAX];
+
+  // a line of a thousand words, with operators and redirections.
+  size_t size = 0;
+  FILE *stream = open_memstream(&long_line, &size);
+  for (int i = 0; i < 100; i++) {
+    fprintf(stream, "grep -rn pattern%d src/dir%d/file%d.c > out%d.txt 2>&1 | "
+                    "sort -u | head -n 10 && echo done%d ; ", i, i, i, i, i);
+  }
+  fprintf(stream, "true\n");
+  fclose(stream);
+  long_line_tokens = tokenize(&bench_arena, long_line, " \t\r\n", "!><|;&");
+
+  plain_words = arena_alloc(&bench_arena, sizeof(char *) * 201);
+  for (int i = 0; i < 200; i++) {
+    snprintf(name, sizeof(name), "word%d", i);
+    plain_words[i] = arena_strdup(&bench_arena, name);
+  }
+  plain_words[200] = NULL;
+
+  // a huge directory, half of which matches the pattern.
+  long nfiles = get_count("BENCH_FILES", 100000);
+  snprintf(name, sizeof(name), "%s/huge", corpus);
+  make_files(name, nfiles / 2, ".txt");
+  make_files(name, nfiles - nfiles / 2, ".log");
+  glob_tokens[0] = "ls";
+  snprintf(name, sizeof(name), "%s/huge/*.txt", corpus);
+  glob_tokens[1] = arena_strdup(&bench_arena, name);
+  glob_tokens[2] = NULL;
+
+  // a tree of 64 directories of 100 files each for '**'.
+  for (int i = 0; i < 64; i++) {
+    snprintf(name, sizeof(name), "%s/tree/d%d/e%d", corpus, i % 8, i);
+    make_files(name, 100, (i % 2 == 0) ? ".c" : ".h");
+  }
+  globstar_tokens[0] = "ls";
+  snprintf(name, sizeof(name), "%s/tree/**/*.c", corpus);
+  globstar_tokens[1] = arena_strdup(&bench_arena, name);
+  globstar_tokens[2] = NULL;
+
+  // a long path, with the program in its last directory.
+  path = arena_alloc(&bench_arena, sizeof(char *) * (PATH_DIRECTORIES + 1));
+  for (int i = 0; i < PATH_DIRECTORIES; i++) {
+    snprintf(name, sizeof(name), "%s/path/bin%d", corpus, i);
+    make_files(name, 8, "");
+    path[i] = arena_strdup(&bench_arena, name);
+  }
+  path[PATH_DIRECTORIES] = NULL;
+  snprintf(name, sizeof(name), "%s/target", path[PATH_DIRECTORIES - 1]);
+  close(open(name, O_WRONLY|O_CREAT, 0755));
+
+  // the history of a long-lived account.
+  setenv("HOME", corpus, 1);
+  long nlines = get_count("BENCH_HISTORY", 1000000);
+  snprintf(name, sizeof(name), "%s/.cowrie_history", corpus);
+  FILE *history = fopen(name, "w");
+  static char *commands[] = {
+    "git status", "ls -la /var/log/app%ld", "make -j8 target%ld",
+    "ssh host%ld.example.com uptime", "grep -rn error /srv/logs/%ld.log",
+  };
+  for (long i = 0; i < nlines; i++) {
+    fprintf(history, commands[i % 5], i);
+    fputc('\n', history);
+  }
+  fclose(history);
+
+  // the results are printed on a copy of stdout, where the matches of
+  // search_history can't go.
+  results = fdopen(dup(STDOUT_FILENO), "w");
+  if (results == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+    perror("stdout");
+    exit(1);
+  }
+}
+
+
+// Make 'nfiles' empty files ending with 'suffix' in 'directory', and
+// the directories leading to it.
+static void make_files(char *directory, int nfiles, char *suffix) {
+  char name[PATH_MAX];
+  for (char *slash = strchr(directory + 1, '/'); slash != NULL;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(directory, 0755);
+    *slash = '/';
+  }
+  mkdir(directory, 0755);
+
+  for (int i = 0; i < nfiles; i++) {
+    snprintf(name, sizeof(name), "%s/file%d%s", directory, i, suffix);
+    int fd = open(name, O_WRONLY|O_CREAT, 0644);
+    if (fd == -1) {
+      perror(name);
+      exit(1);
+    }
+    close(fd);
+  }
+}
+
+
+static void remove_corpora() {
+  char command[PATH_MAX + 16];
+  snprintf(command, sizeof(command), "rm -rf '%s'", corpus);
+  if (system(command) != 0) {
+    fprintf(stderr, "bench: couldn't remove %s\n", corpus);
+  }
+}
+
+
+// Returns the number in the environment variable 'variable', or
+// 'default_count' if it isn't set.
+static long get_count(char *variable, long default_count) {
+  char *value = getenv(variable);
+  return (value != NULL && atol(value) > 0) ? atol(value) : default_count;
+}
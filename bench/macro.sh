@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# The commands per second the shell runs in spawn-heavy scripts, run by
+# 'make bench'. Every script has BENCH_COMMANDS lines (2000 by default).
+#
+# Usage: sh bench/macro.sh [path/to/simsh]
+#
+
+simsh=${1:-./simsh}
+ncommands=${BENCH_COMMANDS:-2000}
+# a program, not the builtin of the same name.
+for directory in $(echo "$PATH" | tr : ' '); do
+  if [ -x "$directory/true" ]; then
+    true=$directory/true
+    break
+  fi
+done
+
+corpus=$(mktemp -d /tmp/simsh-macro-XXXXXX) || exit 1
+trap 'rm -rf "$corpus"' EXIT
+
+# run 'line' ncommands times in a new shell, with an empty history.
+run() {
+  name=$1
+  line=$2
+  awk -v n="$ncommands" -v line="$line" \
+    'BEGIN { for (i = 0; i < n; i++) print line }' > "$corpus/script"
+  started=$(date +%s%N)
+  HOME=$corpus "$simsh" < "$corpus/script" > /dev/null 2>&1
+  finished=$(date +%s%N)
+  awk -v name="$name" -v n="$ncommands" -v ns=$((finished - started)) \
+    'BEGIN { printf "%-30s %12.0f commands/s %10.1f us/command\n",
+             name, n / (ns / 1e9), ns / n / 1e3 }'
+}
+
+run "program" "$true"
+run "program with arguments" "$true a b c d e f g h"
+run "pipeline of 3 programs" "$true | $true | $true"
+run "redirections" "$true < /dev/null > /dev/null 2>&1"
+run "builtin" "echo hello > /dev/null"
+run "pipeline with builtins" "echo hello | cat | $true"
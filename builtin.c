@@ -0,0 +1,1396 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <libgen.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "helper.h"
+#include "redirection.h"
+#include "plugin.h"
+#include "builtin.h"
+
+// number of buckets of the dispatch table, a power of two.
+#define BUILTIN_BUCKETS 64
+
+// the most the kernel is asked to copy at once, and the size of the
+// buffer of the copies it can't do.
+#define KERNEL_COPY_SIZE (1 << 30)
+#define COPY_BUFFER_SIZE (1 << 20)
+
+
+struct builtin {
+  char *name;
+  // the function of a utility of the shell, NULL for a loaded builtin.
+  builtin_function function;
+  // the options the utility implements, it's run as a program when
+  // given another. NULL if it takes every word, as a loaded builtin
+  // does.
+  char *options;
+  // what the module defines for a loaded builtin, the module's handle
+  // and the path it was loaded from.
+  struct simsh_builtin *plugin;
+  void *handle;
+  char *module;
+  struct builtin *next;
+};
+
+
+static int do_true(char **argv);
+static int do_false(char **argv);
+static int do_echo(char **argv);
+static int do_printf(char **argv);
+static int do_test(char **argv);
+static int do_bracket(char **argv);
+static int do_cat(char **argv);
+static int do_tee(char **argv);
+static int do_basename(char **argv);
+static int do_dirname(char **argv);
+static int do_enable(char **argv);
+
+static char *read_escape(char *s, char *c, bool zero_octal);
+static int print_escaped(char *s, bool zero_octal);
+static char *print_conversion(char *format, char ***args, int *status,
+                              bool *stop);
+static bool get_number(char *word, long long *number);
+static int evaluate(char **argv, int argc, char *name);
+static bool test_expression(char ***words, char **end, int *status);
+static bool test_term(char ***words, char **end, int *status);
+static bool test_primary(char ***words, char **end, int *status);
+static bool test_unary(char *operator, char *operand, int *status);
+static bool test_binary(char *left, char *operator, char *right, int *status);
+static bool is_binary_operator(char *word);
+static bool is_unary_operator(char *word);
+static int call_builtin(struct builtin *builtin, char **argv);
+static bool takes_options(struct builtin *builtin, char **argv);
+static int copy_file(int fd, char *name);
+static int copy_fd(int in, int out);
+static bool can_fall_back(int error);
+static int copy_loop(int in, int out);
+static int tee_pipe(int *outputs, char **names, int noutputs);
+static int tee_loop(int *outputs, char **names, int noutputs);
+static int drain_pipe(int from, int to, size_t n);
+static int write_all(int fd, char *data, size_t size);
+static char *get_copy_buffer();
+static void init_table();
+static unsigned int hash_name(char *name);
+static struct builtin *lookup_builtin(char *name);
+static struct builtin *add_builtin(char *name);
+static int load_builtin(char *module, char *name);
+static int unload_builtin(char *name);
+static int compare_builtins(const void *a, const void *b);
+
+
+// the utilities, in no particular order. The ones which replace a
+// program run it instead when given an option they don't implement.
+static struct {
+  char *name;
+  builtin_function function;
+  char *options;
+} utilities[] = {
+  { "true", do_true, NULL },
+  { "false", do_false, NULL },
+  { "echo", do_echo, NULL },
+  { "printf", do_printf, NULL },
+  { "test", do_test, NULL },
+  { "[", do_bracket, NULL },
+  { "cat", do_cat, "" },
+  { "tee", do_tee, "a" },
+  { "basename", do_basename, "" },
+  { "dirname", do_dirname, "" },
+  { "enable", do_enable, NULL },
+  { NULL, NULL, NULL },
+};
+
+// the utilities and loaded builtins by the hash of their names.
+static struct builtin *table[BUILTIN_BUCKETS];
+static bool table_ready = false;
+// counts the builtins loaded and unloaded.
+static unsigned long table_generation;
+
+// the buffer of copy_loop and drain_pipe, allocated when first used.
+static char *copy_buffer;
+
+
+struct builtin *find_builtin(char **argv) {
+  struct builtin *builtin = lookup_builtin(argv[0]);
+  if (builtin != NULL && !takes_options(builtin, argv)) {
+    return NULL;
+  }
+  return builtin;
+}
+
+
+char **get_builtin_names() {
+  if (!table_ready) {
+    init_table();
+  }
+
+  char **commands = get_builtin_commands();
+  int nnames = count_nwords(commands);
+  for (int i = 0; i < BUILTIN_BUCKETS; i++) {
+    for (struct builtin *b = table[i]; b != NULL; b = b->next) {
+      nnames++;
+    }
+  }
+
+  char **names = malloc(sizeof(char *) * (nnames + 1));
+  int n = 0;
+  for (int i = 0; commands[i] != NULL; i++) {
+    names[n++] = strdup(commands[i]);
+  }
+  for (int i = 0; i < BUILTIN_BUCKETS; i++) {
+    for (struct builtin *b = table[i]; b != NULL; b = b->next) {
+      names[n++] = strdup(b->name);
+    }
+  }
+  names[n] = NULL;
+  return names;
+}
+
+
+unsigned long get_builtins_generation() {
+  return table_generation;
+}
+
+
+int run_builtin(struct builtin *builtin, char **argv, struct stage *stage) {
+  int nredirections = stage->nredirections;
+  struct fd_action actions[nredirections + 1];
+  int fds[nredirections + 1];
+  int saved[nredirections + 1];
+
+  if (open_redirections(stage->redirections, nredirections, actions, fds) == -1) {
+    return 1;
+  }
+  // what was written before goes where stdout was.
+  fflush(stdout);
+  if (swap_fds(actions, nredirections, saved) == -1) {
+    close_redirection_fds(fds, nredirections);
+    return 1;
+  }
+  close_redirection_fds(fds, nredirections);
+
+  int status = call_builtin(builtin, argv);
+  restore_fds(actions, nredirections, saved);
+  return status;
+}
+
+
+pid_t spawn_builtin(struct builtin *builtin, char **argv,
+                    struct fd_action *actions, int nactions,
+                    struct spawn_group *group) {
+  pid_t pid = spawn_fork(actions, nactions, group);
+  if (pid == 0) {
+    _exit(call_builtin(builtin, argv));
+  }
+  return pid;
+}
+
+
+// Run a utility with its descriptors already in place, and flush what
+// it wrote. Returns its exit status.
+static int call_builtin(struct builtin *builtin, char **argv) {
+  int status;
+  if (builtin->plugin != NULL) {
+    // a loaded builtin writes to the descriptors itself.
+    fflush(stdout);
+    status = builtin->plugin->main(count_nwords(argv), argv, STDIN_FILENO,
+                                   STDOUT_FILENO, STDERR_FILENO);
+  } else {
+    status = builtin->function(argv);
+  }
+
+  if (fflush(stdout) == EOF || ferror(stdout)) {
+    fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+    clearerr(stdout);
+    status = 1;
+  }
+  return status;
+}
+
+
+// Returns true if the utility implements every option of 'argv', which
+// come before its operands as only they are taken as options. A lone
+// '-' is an operand, and every word after '--' is one.
+static bool takes_options(struct builtin *builtin, char **argv) {
+  if (builtin->options == NULL || builtin->plugin != NULL) {
+    return true;
+  }
+
+  bool operands = false;
+  for (int i = 1; argv[i] != NULL && strcmp(argv[i], "--") != 0; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == '\0') {
+      operands = true;
+      continue;
+    }
+    // the program would take an option after an operand too.
+    if (operands) {
+      return false;
+    }
+    for (char *c = &argv[i][1]; *c != '\0'; c++) {
+      if (strchr(builtin->options, *c) == NULL) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+static int do_true(char **argv) {
+  (void) argv;
+  return 0;
+}
+
+
+static int do_false(char **argv) {
+  (void) argv;
+  return 1;
+}
+
+
+//
+// Print the arguments separated by spaces. '-n' leaves out the
+// newline, '-e' interprets backslash escapes and '-E' doesn't.
+//
+// Synopsis: echo [-neE] [arg...]
+//
+static int do_echo(char **argv) {
+  bool newline = true;
+  bool escapes = false;
+
+  int i = 1;
+  for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+    // a word with other letters is printed.
+    if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1)) {
+      break;
+    }
+    for (char *c = argv[i] + 1; *c != '\0'; c++) {
+      if (*c == 'n') {
+        newline = false;
+      } else {
+        escapes = (*c == 'e');
+      }
+    }
+  }
+
+  for (bool first = true; argv[i] != NULL; i++, first = false) {
+    if (!first) {
+      putchar(' ');
+    }
+    if (!escapes) {
+      fputs(argv[i], stdout);
+    } else if (print_escaped(argv[i], true) == -1) {
+      // '\c' stops the output.
+      return 0;
+    }
+  }
+  if (newline) {
+    putchar('\n');
+  }
+  return 0;
+}
+
+
+//
+// Print the arguments as the format says, the format is reused until
+// every argument is used.
+//
+// Synopsis: printf format [arg...]
+//
+static int do_printf(char **argv) {
+  if (argv[1] == NULL) {
+    fprintf(stderr, "printf: usage: printf format [arguments]\n");
+    return 2;
+  }
+
+  char *format = argv[1];
+  char **args = &argv[2];
+  int status = 0;
+  bool stop = false;
+
+  do {
+    char **start = args;
+    for (char *c = format; *c != '\0' && !stop; ) {
+      if (*c == '\\') {
+        char escaped;
+        c = read_escape(c + 1, &escaped, false);
+        if (c == NULL) {
+          return status;
+        }
+        putchar(escaped);
+      } else if (*c == '%' && c[1] == '%') {
+        putchar('%');
+        c += 2;
+      } else if (*c == '%') {
+        c = print_conversion(c, &args, &status, &stop);
+        if (c == NULL) {
+          return 1;
+        }
+      } else {
+        putchar(*c++);
+      }
+    }
+    // a format without conversions is printed once.
+    if (args == start) {
+      break;
+    }
+  } while (*args != NULL && !stop);
+
+  return status;
+}
+
+
+//
+// Evaluate a conditional expression, the exit status is 0 if it's
+// true, 1 if it's false and 2 if it can't be evaluated.
+//
+// Synopsis: test expression
+//           [ expression ]
+//
+static int do_test(char **argv) {
+  return evaluate(&argv[1], count_nwords(argv) - 1, "test");
+}
+
+
+static int do_bracket(char **argv) {
+  int argc = count_nwords(argv);
+  if (strcmp(argv[argc - 1], "]") != 0) {
+    fprintf(stderr, "[: missing `]'\n");
+    return 2;
+  }
+  return evaluate(&argv[1], argc - 2, "[");
+}
+
+
+//
+// Print the files in order, or stdin if there are none or for '-'.
+//
+// Synopsis: cat [--] [file...]
+//
+static int do_cat(char **argv) {
+  // the output of cat doesn't go through stdio.
+  fflush(stdout);
+
+  int first = (argv[1] != NULL && strcmp(argv[1], "--") == 0) ? 2 : 1;
+  if (argv[first] == NULL) {
+    return copy_file(STDIN_FILENO, "-");
+  }
+
+  int status = 0;
+  for (int i = first; argv[i] != NULL; i++) {
+    if (strcmp(argv[i], "-") == 0) {
+      status |= copy_file(STDIN_FILENO, "-");
+      continue;
+    }
+
+    int fd = open(argv[i], O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+      fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+    status |= copy_file(fd, argv[i]);
+    close(fd);
+  }
+  return status;
+}
+
+
+//
+// Copy stdin to stdout and to every file, which is truncated first, or
+// appended to with '-a'.
+//
+// Synopsis: tee [-a] [file...]
+//
+static int do_tee(char **argv) {
+  // the output of tee doesn't go through stdio.
+  fflush(stdout);
+
+  int flags = O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC;
+  int i = 1;
+  for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(argv[i], "-a") == 0) {
+      flags = O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC;
+    } else {
+      fprintf(stderr, "tee: %s: invalid option\n", argv[i]);
+      return 1;
+    }
+  }
+
+  int nfiles = count_nwords(&argv[i]);
+  int outputs[nfiles + 1];
+  char *names[nfiles + 1];
+  int noutputs = 0;
+  outputs[noutputs] = STDOUT_FILENO;
+  names[noutputs++] = "standard output";
+
+  int status = 0;
+  for (; argv[i] != NULL; i++) {
+    int fd = open(argv[i], flags, 0666);
+    if (fd == -1) {
+      fprintf(stderr, "tee: %s: %s\n", argv[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+    outputs[noutputs] = fd;
+    names[noutputs++] = argv[i];
+  }
+
+  // only the data in a pipe can be duplicated by the kernel.
+  struct stat s;
+  int copied = -1;
+  if (fstat(STDIN_FILENO, &s) == 0 && S_ISFIFO(s.st_mode)) {
+    copied = tee_pipe(outputs, names, noutputs);
+  }
+  if (copied == -1) {
+    copied = tee_loop(outputs, names, noutputs);
+  }
+  status |= copied;
+
+  for (int j = 1; j < noutputs; j++) {
+    if (outputs[j] != -1) {
+      close(outputs[j]);
+    }
+  }
+  return status;
+}
+
+
+//
+// Print the last component of a pathname, without 'suffix'.
+//
+// Synopsis: basename [--] name [suffix]
+//
+static int do_basename(char **argv) {
+  if (argv[1] != NULL && strcmp(argv[1], "--") == 0) {
+    argv++;
+  }
+  if (argv[1] == NULL) {
+    fprintf(stderr, "basename: missing operand\n");
+    return 1;
+  }
+  if (argv[2] != NULL && argv[3] != NULL) {
+    fprintf(stderr, "basename: extra operand '%s'\n", argv[3]);
+    return 1;
+  }
+
+  // strip the trailing slashes, a name of only slashes is '/'.
+  char *name = argv[1];
+  size_t length = strlen(name);
+  while (length > 1 && name[length - 1] == '/') {
+    length--;
+  }
+  char *start = name + length;
+  while (start > name && start[-1] != '/') {
+    start--;
+  }
+  if (length == 1 && name[0] == '/') {
+    start = name;
+  }
+  size_t base_length = name + length - start;
+
+  char *suffix = argv[2];
+  if (suffix != NULL) {
+    size_t suffix_length = strlen(suffix);
+    if (suffix_length < base_length &&
+        strncmp(start + base_length - suffix_length, suffix, suffix_length) == 0) {
+      base_length -= suffix_length;
+    }
+  }
+
+  printf("%.*s\n", (int) base_length, start);
+  return 0;
+}
+
+
+//
+// Print every pathname without its last component.
+//
+// Synopsis: dirname [--] name...
+//
+static int do_dirname(char **argv) {
+  if (argv[1] != NULL && strcmp(argv[1], "--") == 0) {
+    argv++;
+  }
+  if (argv[1] == NULL) {
+    fprintf(stderr, "dirname: missing operand\n");
+    return 1;
+  }
+
+  for (int i = 1; argv[i] != NULL; i++) {
+    // dirname() changes the string, it's the shell's copy of the word.
+    char *name = strdupa(argv[i]);
+    printf("%s\n", dirname(name));
+  }
+  return 0;
+}
+
+
+//
+// Load builtins from a shared object, unload them, or list the
+// builtins run in the shell.
+//
+// Synopsis: enable [-f module name...] [-d name...]
+// Examples:
+//     % enable
+//     % enable -f ./hello.so hello
+//     % enable -d hello
+//
+static int do_enable(char **argv) {
+  if (argv[1] == NULL) {
+    struct builtin *builtins[BUILTIN_BUCKETS * 4];
+    int nbuiltins = 0;
+    for (int i = 0; i < BUILTIN_BUCKETS; i++) {
+      for (struct builtin *b = table[i]; b != NULL; b = b->next) {
+        if (nbuiltins < BUILTIN_BUCKETS * 4) {
+          builtins[nbuiltins++] = b;
+        }
+      }
+    }
+    qsort(builtins, nbuiltins, sizeof(*builtins), compare_builtins);
+
+    for (int i = 0; i < nbuiltins; i++) {
+      if (builtins[i]->plugin != NULL) {
+        printf("enable -f %s %s\t# %s\n", builtins[i]->module,
+               builtins[i]->name, builtins[i]->plugin->description);
+      } else {
+        printf("enable %s\n", builtins[i]->name);
+      }
+    }
+    return 0;
+  }
+
+  int status = 0;
+  if (strcmp(argv[1], "-f") == 0) {
+    if (argv[2] == NULL || argv[3] == NULL) {
+      fprintf(stderr, "enable: usage: enable -f module name...\n");
+      return 2;
+    }
+    for (int i = 3; argv[i] != NULL; i++) {
+      status |= load_builtin(argv[2], argv[i]);
+    }
+  } else if (strcmp(argv[1], "-d") == 0) {
+    for (int i = 2; argv[i] != NULL; i++) {
+      status |= unload_builtin(argv[i]);
+    }
+  } else {
+    fprintf(stderr, "enable: %s: invalid option\n", argv[1]);
+    return 2;
+  }
+  return status;
+}
+
+
+// Read the escape sequence after a backslash at 's', saves the
+// character it stands for into 'c' and returns where it ends. Octal
+// escapes start with '\0' if 'zero_octal' is true. Returns NULL for
+// '\c', which stops the output.
+static char *read_escape(char *s, char *c, bool zero_octal) {
+  static char *escapes = "a\ab\be\033f\fn\nr\rt\tv\v\\\\";
+
+  char *escape = (*s != '\0') ? strchr(escapes, *s) : NULL;
+  if (escape != NULL && (escape - escapes) % 2 == 0) {
+    *c = escape[1];
+    return s + 1;
+  }
+
+  if (*s == 'c') {
+    return NULL;
+  }
+
+  if (*s == 'x' && isxdigit((unsigned char) s[1])) {
+    int value = 0;
+    int i = 1;
+    for (; i <= 2 && isxdigit((unsigned char) s[i]); i++) {
+      value = value * 16 + (isdigit((unsigned char) s[i]) ? s[i] - '0'
+                            : (tolower((unsigned char) s[i]) - 'a' + 10));
+    }
+    *c = value;
+    return s + i;
+  }
+
+  char *digits = (zero_octal && *s == '0') ? s + 1 : s;
+  if (*digits >= '0' && *digits <= '7' && (zero_octal ? *s == '0' : true)) {
+    int value = 0;
+    int i = 0;
+    for (; i < 3 && digits[i] >= '0' && digits[i] <= '7'; i++) {
+      value = value * 8 + (digits[i] - '0');
+    }
+    *c = value;
+    return digits + i;
+  }
+  if (zero_octal && *s == '0') {
+    *c = '\0';
+    return s + 1;
+  }
+
+  // not an escape, the backslash is printed as it is.
+  *c = '\\';
+  return s;
+}
+
+
+// Print 's' with its backslash escapes interpreted, returns -1 if it
+// has '\c'.
+static int print_escaped(char *s, bool zero_octal) {
+  while (*s != '\0') {
+    if (*s != '\\') {
+      putchar(*s++);
+      continue;
+    }
+    char c;
+    s = read_escape(s + 1, &c, zero_octal);
+    if (s == NULL) {
+      return -1;
+    }
+    putchar(c);
+  }
+  return 0;
+}
+
+
+// Print the conversion starting at 'format' with the next argument,
+// which '*args' is moved past. Returns where the conversion ends, or
+// NULL and prints a message if it's invalid. 'stop' is set by '\c' in
+// the argument of '%b'.
+static char *print_conversion(char *format, char ***args, int *status,
+                              bool *stop) {
+  // '%' with its flags, width and precision, the '*'s replaced.
+  char spec[64];
+  size_t length = 0;
+  spec[length++] = '%';
+
+  char *c = format + 1;
+  while (*c != '\0' && strchr("-+ #0", *c) != NULL && length < 8) {
+    spec[length++] = *c++;
+  }
+  for (int part = 0; part < 2; part++) {
+    if (part == 1) {
+      if (*c != '.') {
+        break;
+      }
+      spec[length++] = *c++;
+    }
+    if (*c == '*') {
+      long long value = 0;
+      if (**args != NULL && !get_number(*(*args)++, &value)) {
+        *status = 1;
+      }
+      length += snprintf(spec + length, 16, "%d", (int) value);
+      c++;
+    } else {
+      while (*c >= '0' && *c <= '9' && length < 40) {
+        spec[length++] = *c++;
+      }
+    }
+  }
+
+  char conversion = *c;
+  if (conversion == '\0' || strchr("diouxXcsbfFeEgGaA", conversion) == NULL) {
+    fprintf(stderr, "printf: %%%c: invalid format character\n", conversion);
+    return NULL;
+  }
+
+  // missing arguments are empty strings or zero.
+  char *argument = (**args != NULL) ? *(*args)++ : "";
+
+  if (strchr("di", conversion) != NULL) {
+    long long value;
+    if (!get_number(argument, &value)) {
+      *status = 1;
+    }
+    strcpy(spec + length, "lld");
+    printf(spec, value);
+
+  } else if (strchr("ouxX", conversion) != NULL) {
+    long long value;
+    if (!get_number(argument, &value)) {
+      *status = 1;
+    }
+    snprintf(spec + length, 4, "ll%c", conversion);
+    printf(spec, (unsigned long long) value);
+
+  } else if (conversion == 'c') {
+    strcpy(spec + length, "c");
+    printf(spec, argument[0]);
+
+  } else if (conversion == 's') {
+    strcpy(spec + length, "s");
+    printf(spec, argument);
+
+  } else if (conversion == 'b') {
+    // the escapes of the argument are interpreted like echo -e's.
+    if (print_escaped(argument, true) == -1) {
+      *stop = true;
+    }
+
+  } else {
+    char *end;
+    errno = 0;
+    double value = strtod(argument, &end);
+    if (*argument != '\0' && (*end != '\0' || errno != 0)) {
+      fprintf(stderr, "printf: %s: invalid number\n", argument);
+      *status = 1;
+    }
+    snprintf(spec + length, 2, "%c", conversion);
+    printf(spec, value);
+  }
+  return c + 1;
+}
+
+
+// Saves the integer 'word' stands for into 'number', a word starting
+// with a quote is the code of the character after it. Returns false
+// and prints a message if it isn't a number.
+static bool get_number(char *word, long long *number) {
+  if (word[0] == '\'' || word[0] == '"') {
+    *number = (unsigned char) word[1];
+    return true;
+  }
+
+  char *end;
+  errno = 0;
+  *number = strtoll(word, &end, 0);
+  if (*word != '\0' && (*end != '\0' || errno != 0)) {
+    fprintf(stderr, "printf: %s: invalid number\n", word);
+    return false;
+  }
+  return true;
+}
+
+
+// Evaluate the expression of 'argc' words of test or '['.
+static int evaluate(char **argv, int argc, char *name) {
+  if (argc == 0) {
+    return 1;
+  }
+
+  int status = 0;
+  char **words = argv;
+  char **end = argv + argc;
+  bool result;
+
+  // the meaning of up to three words depends on how many there are,
+  // so '-n' alone is a non-empty string and '! -z' is negated '-z'.
+  if (argc == 1) {
+    result = (argv[0][0] != '\0');
+  } else if (argc == 2 && strcmp(argv[0], "!") == 0) {
+    result = (argv[1][0] == '\0');
+  } else if (argc == 2 && is_unary_operator(argv[0])) {
+    result = test_unary(argv[0], argv[1], &status);
+  } else if (argc == 3 && is_binary_operator(argv[1])) {
+    result = test_binary(argv[0], argv[1], argv[2], &status);
+  } else {
+    result = test_expression(&words, end, &status);
+    if (status == 0 && words != end) {
+      fprintf(stderr, "%s: %s: unexpected argument\n", name, *words);
+      status = 2;
+    }
+  }
+
+  if (status != 0) {
+    return 2;
+  }
+  return result ? 0 : 1;
+}
+
+
+// expression: term ['-o' expression]
+static bool test_expression(char ***words, char **end, int *status) {
+  bool result = test_term(words, end, status);
+  while (*words < end && strcmp(**words, "-o") == 0) {
+    (*words)++;
+    // both sides are parsed, whatever the result is.
+    bool right = test_term(words, end, status);
+    result = result || right;
+  }
+  return result;
+}
+
+
+// term: primary ['-a' term]
+static bool test_term(char ***words, char **end, int *status) {
+  bool result = test_primary(words, end, status);
+  while (*words < end && strcmp(**words, "-a") == 0) {
+    (*words)++;
+    bool right = test_primary(words, end, status);
+    result = result && right;
+  }
+  return result;
+}
+
+
+// primary: '!' primary | '(' expression ')' | unary-op word
+//          | word binary-op word | word
+static bool test_primary(char ***words, char **end, int *status) {
+  if (*words >= end) {
+    fprintf(stderr, "test: argument expected\n");
+    *status = 2;
+    return false;
+  }
+
+  char *word = **words;
+  if (strcmp(word, "!") == 0) {
+    (*words)++;
+    return !test_primary(words, end, status);
+  }
+
+  if (strcmp(word, "(") == 0 && *words + 1 < end) {
+    (*words)++;
+    bool result = test_expression(words, end, status);
+    if (*words >= end || strcmp(**words, ")") != 0) {
+      fprintf(stderr, "test: `)' expected\n");
+      *status = 2;
+      return false;
+    }
+    (*words)++;
+    return result;
+  }
+
+  if (*words + 2 < end && is_binary_operator((*words)[1])) {
+    bool result = test_binary(word, (*words)[1], (*words)[2], status);
+    *words += 3;
+    return result;
+  }
+
+  if (is_unary_operator(word) && *words + 1 < end) {
+    bool result = test_unary(word, (*words)[1], status);
+    *words += 2;
+    return result;
+  }
+
+  (*words)++;
+  return word[0] != '\0';
+}
+
+
+static bool test_unary(char *operator, char *operand, int *status) {
+  struct stat s;
+  char op = operator[1];
+
+  switch (op) {
+  case 'z':
+    return operand[0] == '\0';
+  case 'n':
+    return operand[0] != '\0';
+  case 't':
+    return isatty(atoi(operand));
+  case 'L':
+  case 'h':
+    return lstat(operand, &s) == 0 && S_ISLNK(s.st_mode);
+  case 'r':
+    return faccessat(AT_FDCWD, operand, R_OK, AT_EACCESS) == 0;
+  case 'w':
+    return faccessat(AT_FDCWD, operand, W_OK, AT_EACCESS) == 0;
+  case 'x':
+    return faccessat(AT_FDCWD, operand, X_OK, AT_EACCESS) == 0;
+  }
+
+  if (stat(operand, &s) == -1) {
+    return false;
+  }
+  switch (op) {
+  case 'e':
+    return true;
+  case 'f':
+    return S_ISREG(s.st_mode);
+  case 'd':
+    return S_ISDIR(s.st_mode);
+  case 'b':
+    return S_ISBLK(s.st_mode);
+  case 'c':
+    return S_ISCHR(s.st_mode);
+  case 'p':
+    return S_ISFIFO(s.st_mode);
+  case 'S':
+    return S_ISSOCK(s.st_mode);
+  case 's':
+    return s.st_size > 0;
+  case 'u':
+    return (s.st_mode & S_ISUID) != 0;
+  case 'g':
+    return (s.st_mode & S_ISGID) != 0;
+  case 'k':
+    return (s.st_mode & S_ISVTX) != 0;
+  }
+
+  *status = 2;
+  return false;
+}
+
+
+static bool test_binary(char *left, char *operator, char *right, int *status) {
+  if (strcmp(operator, "=") == 0 || strcmp(operator, "==") == 0) {
+    return strcmp(left, right) == 0;
+  } else if (strcmp(operator, "!=") == 0) {
+    return strcmp(left, right) != 0;
+  }
+
+  if (strcmp(operator, "-nt") == 0 || strcmp(operator, "-ot") == 0 ||
+      strcmp(operator, "-ef") == 0) {
+    struct stat l, r;
+    bool l_exists = (stat(left, &l) == 0);
+    bool r_exists = (stat(right, &r) == 0);
+    if (strcmp(operator, "-ef") == 0) {
+      return l_exists && r_exists && l.st_dev == r.st_dev && l.st_ino == r.st_ino;
+    }
+    if (!l_exists || !r_exists) {
+      // a file exists is newer than one which doesn't.
+      return strcmp(operator, "-nt") == 0 ? l_exists : r_exists;
+    }
+    bool newer = (l.st_mtim.tv_sec > r.st_mtim.tv_sec ||
+                  (l.st_mtim.tv_sec == r.st_mtim.tv_sec &&
+                   l.st_mtim.tv_nsec > r.st_mtim.tv_nsec));
+    bool older = (l.st_mtim.tv_sec < r.st_mtim.tv_sec ||
+                  (l.st_mtim.tv_sec == r.st_mtim.tv_sec &&
+                   l.st_mtim.tv_nsec < r.st_mtim.tv_nsec));
+    return strcmp(operator, "-nt") == 0 ? newer : older;
+  }
+
+  // the rest compare integers.
+  char *end;
+  long long l = strtoll(left, &end, 10);
+  if (*left == '\0' || *end != '\0') {
+    fprintf(stderr, "test: %s: integer expression expected\n", left);
+    *status = 2;
+    return false;
+  }
+  long long r = strtoll(right, &end, 10);
+  if (*right == '\0' || *end != '\0') {
+    fprintf(stderr, "test: %s: integer expression expected\n", right);
+    *status = 2;
+    return false;
+  }
+
+  if (strcmp(operator, "-eq") == 0) {
+    return l == r;
+  } else if (strcmp(operator, "-ne") == 0) {
+    return l != r;
+  } else if (strcmp(operator, "-lt") == 0) {
+    return l < r;
+  } else if (strcmp(operator, "-le") == 0) {
+    return l <= r;
+  } else if (strcmp(operator, "-gt") == 0) {
+    return l > r;
+  }
+  return l >= r;
+}
+
+
+static bool is_binary_operator(char *word) {
+  static char *operators[] = {
+    "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+    "-nt", "-ot", "-ef", NULL,
+  };
+  for (int i = 0; operators[i] != NULL; i++) {
+    if (strcmp(word, operators[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static bool is_unary_operator(char *word) {
+  return word[0] == '-' && word[1] != '\0' && word[2] == '\0' &&
+         strchr("bcdefghknprsStuwxzL", word[1]) != NULL;
+}
+
+
+// Copy the file open as 'fd' to stdout, returns 1 if it fails.
+static int copy_file(int fd, char *name) {
+  // appending a file to itself would never end.
+  struct stat in, out;
+  if (fstat(fd, &in) == 0 && fstat(STDOUT_FILENO, &out) == 0 &&
+      S_ISREG(in.st_mode) && in.st_dev == out.st_dev && in.st_ino == out.st_ino) {
+    fprintf(stderr, "cat: %s: input file is output file\n", name);
+    return 1;
+  }
+
+  if (copy_fd(fd, STDOUT_FILENO) == -1) {
+    fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+
+// Copy the rest of 'in' to 'out', in the kernel where it can be: with
+// copy_file_range between regular files, which may share their blocks
+// on a file system which can, and with splice when either is a pipe.
+// Returns -1 with errno set if reading or writing fails.
+static int copy_fd(int in, int out) {
+  struct stat in_stat, out_stat;
+  if (fstat(in, &in_stat) == -1 || fstat(out, &out_stat) == -1) {
+    return -1;
+  }
+
+  ssize_t n = -1;
+  errno = EINVAL;
+  if (S_ISREG(in_stat.st_mode) && S_ISREG(out_stat.st_mode)) {
+    while ((n = copy_file_range(in, NULL, out, NULL, KERNEL_COPY_SIZE, 0)) > 0 ||
+           (n == -1 && errno == EINTR)) {
+    }
+  } else if (S_ISFIFO(in_stat.st_mode) || S_ISFIFO(out_stat.st_mode)) {
+    while ((n = splice(in, NULL, out, NULL, KERNEL_COPY_SIZE,
+                       SPLICE_F_MOVE|SPLICE_F_MORE)) > 0 ||
+           (n == -1 && errno == EINTR)) {
+    }
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+  // the offsets moved along with what was copied, the loop goes on
+  // from there.
+  if (!can_fall_back(errno)) {
+    return -1;
+  }
+  return copy_loop(in, out);
+}
+
+
+// Returns true if a copy by the kernel failed with 'error' only because
+// it can't be done between these files, like to a terminal, across
+// file systems or to a file open for appending.
+static bool can_fall_back(int error) {
+  return error == EINVAL || error == EXDEV || error == ENOSYS ||
+         error == EOPNOTSUPP || error == EBADF;
+}
+
+
+// Copy the rest of 'in' to 'out' through a buffer. Returns -1 with
+// errno set if reading or writing fails.
+static int copy_loop(int in, int out) {
+  char *buffer = get_copy_buffer();
+  if (buffer == NULL) {
+    return -1;
+  }
+
+  ssize_t nread;
+  while ((nread = read(in, buffer, COPY_BUFFER_SIZE)) != 0) {
+    if (nread == -1 && errno == EINTR) {
+      continue;
+    }
+    if (nread == -1 || write_all(out, buffer, nread) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+// Copy the pipe on stdin to every one of 'outputs' without reading it:
+// each round tee(2) clones what's in the pipe into a pipe of every
+// output but the last, which splice moves it into, and these pipes are
+// then spliced to the outputs. An output which can't be written to is
+// reported and set to -1. Returns 1 if one couldn't be, 0 if all were,
+// or -1 if the pipes couldn't be set up, before anything is read.
+static int tee_pipe(int *outputs, char **names, int noutputs) {
+  // the pipes hold as much as stdin, so every clone fits whole.
+  int capacity = fcntl(STDIN_FILENO, F_GETPIPE_SZ);
+  int pipes[noutputs][2];
+  int npipes = 0;
+  bool ready = (capacity > 0);
+  while (ready && npipes < noutputs && pipe2(pipes[npipes], O_CLOEXEC) == 0) {
+    ready = (fcntl(pipes[npipes++][1], F_SETPIPE_SZ, capacity) >= capacity);
+  }
+
+  int status = (ready && npipes == noutputs) ? 0 : -1;
+  while (status != -1) {
+    // the first clone is as much as stdin holds, the others the same.
+    ssize_t n = capacity;
+    for (int i = 0; i < noutputs && n > 0; i++) {
+      ssize_t copied;
+      do {
+        if (i < noutputs - 1) {
+          copied = tee(STDIN_FILENO, pipes[i][1], n, 0);
+        } else {
+          copied = splice(STDIN_FILENO, NULL, pipes[i][1], NULL, n, 0);
+        }
+      } while (copied == -1 && errno == EINTR);
+
+      if (copied == -1) {
+        fprintf(stderr, "tee: read error: %s\n", strerror(errno));
+        status = 1;
+      }
+      n = (copied == -1) ? 0 : copied;
+    }
+    if (n == 0) {
+      break;
+    }
+
+    for (int i = 0; i < noutputs; i++) {
+      if (drain_pipe(pipes[i][0], outputs[i], n) == -1) {
+        fprintf(stderr, "tee: %s: %s\n", names[i], strerror(errno));
+        if (i > 0) {
+          close(outputs[i]);
+        }
+        outputs[i] = -1;
+        status = 1;
+      }
+    }
+  }
+
+  for (int i = 0; i < npipes; i++) {
+    close(pipes[i][0]);
+    close(pipes[i][1]);
+  }
+  return status;
+}
+
+
+// Copy stdin to every one of 'outputs' through a buffer, an output
+// which can't be written to is reported and set to -1. Returns 1 if
+// reading or writing failed.
+static int tee_loop(int *outputs, char **names, int noutputs) {
+  char *buffer = get_copy_buffer();
+  if (buffer == NULL) {
+    fprintf(stderr, "tee: %s\n", strerror(errno));
+    return 1;
+  }
+
+  int status = 0;
+  ssize_t nread;
+  while ((nread = read(STDIN_FILENO, buffer, COPY_BUFFER_SIZE)) != 0) {
+    if (nread == -1 && errno == EINTR) {
+      continue;
+    }
+    if (nread == -1) {
+      fprintf(stderr, "tee: read error: %s\n", strerror(errno));
+      return 1;
+    }
+    for (int i = 0; i < noutputs; i++) {
+      if (outputs[i] != -1 && write_all(outputs[i], buffer, nread) == -1) {
+        fprintf(stderr, "tee: %s: %s\n", names[i], strerror(errno));
+        if (i > 0) {
+          close(outputs[i]);
+        }
+        outputs[i] = -1;
+        status = 1;
+      }
+    }
+  }
+  return status;
+}
+
+
+// Move 'n' bytes out of the pipe 'from' to 'to', or throw them away if
+// 'to' is -1. All of them are taken out of the pipe even if writing
+// fails, then -1 is returned with errno set.
+static int drain_pipe(int from, int to, size_t n) {
+  int error = 0;
+  while (n > 0) {
+    ssize_t moved = -1;
+    if (to != -1) {
+      moved = splice(from, NULL, to, NULL, n, SPLICE_F_MOVE|SPLICE_F_MORE);
+      if (moved == -1 && errno == EINTR) {
+        continue;
+      }
+      if (moved == -1 && !can_fall_back(errno)) {
+        error = errno;
+        to = -1;
+      }
+    }
+
+    if (moved == -1) {
+      // a terminal can't be spliced to, and what's thrown away is
+      // read out.
+      char *buffer = get_copy_buffer();
+      if (buffer == NULL) {
+        return -1;
+      }
+      moved = read(from, buffer, (n < COPY_BUFFER_SIZE) ? n : COPY_BUFFER_SIZE);
+      if (moved == -1 && errno == EINTR) {
+        continue;
+      }
+      if (moved <= 0) {
+        return -1;
+      }
+      if (to != -1 && write_all(to, buffer, moved) == -1) {
+        error = errno;
+        to = -1;
+      }
+    }
+    n -= moved;
+  }
+
+  errno = error;
+  return (error == 0) ? 0 : -1;
+}
+
+
+// Write all of 'data' to 'fd', returns -1 with errno set if it fails.
+static int write_all(int fd, char *data, size_t size) {
+  for (size_t written = 0; written < size; ) {
+    ssize_t n = write(fd, data + written, size - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      return -1;
+    }
+    written += n;
+  }
+  return 0;
+}
+
+
+// Returns the buffer of the copies the kernel can't do, or NULL with
+// errno set if it can't be allocated.
+static char *get_copy_buffer() {
+  if (copy_buffer == NULL) {
+    copy_buffer = malloc(COPY_BUFFER_SIZE);
+  }
+  return copy_buffer;
+}
+
+
+// Add the utilities of the shell to the dispatch table.
+static void init_table() {
+  table_ready = true;
+  for (int i = 0; utilities[i].name != NULL; i++) {
+    struct builtin *builtin = add_builtin(utilities[i].name);
+    builtin->function = utilities[i].function;
+    builtin->options = utilities[i].options;
+  }
+}
+
+
+// Returns the entry of 'name' in the dispatch table, or NULL if there's
+// none.
+static struct builtin *lookup_builtin(char *name) {
+  if (!table_ready) {
+    init_table();
+  }
+
+  struct builtin *builtin = table[hash_name(name)];
+  while (builtin != NULL && strcmp(builtin->name, name) != 0) {
+    builtin = builtin->next;
+  }
+  return builtin;
+}
+
+
+// FNV-1a hash of a name, as a bucket of the dispatch table.
+static unsigned int hash_name(char *name) {
+  unsigned int hash = 2166136261u;
+  for (unsigned char *c = (unsigned char *) name; *c != '\0'; c++) {
+    hash = (hash ^ *c) * 16777619u;
+  }
+  return hash & (BUILTIN_BUCKETS - 1);
+}
+
+
+// Returns the entry of 'name', adding an empty one to the table if
+// there's none.
+static struct builtin *add_builtin(char *name) {
+  struct builtin *builtin = lookup_builtin(name);
+  if (builtin != NULL) {
+    return builtin;
+  }
+
+  unsigned int bucket = hash_name(name);
+  builtin = calloc(1, sizeof(*builtin));
+  builtin->name = strdup(name);
+  builtin->next = table[bucket];
+  table[bucket] = builtin;
+  return builtin;
+}
+
+
+// Load the builtin 'name' from 'module', which replaces a utility of
+// the same name. Returns 1 and prints a message if it can't be loaded.
+static int load_builtin(char *module, char *name) {
+  if (is_builtin_command(name)) {
+    fprintf(stderr, "enable: %s: is a shell builtin\n", name);
+    return 1;
+  }
+
+  // a module without a '/' would be searched for like a library.
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s%s", strchr(module, '/') ? "" : "./", module);
+  void *handle = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+  if (handle == NULL) {
+    fprintf(stderr, "enable: %s\n", dlerror());
+    return 1;
+  }
+
+  char symbol[strlen(name) + sizeof("_builtin")];
+  sprintf(symbol, "%s_builtin", name);
+  struct simsh_builtin *plugin = dlsym(handle, symbol);
+  if (plugin == NULL) {
+    fprintf(stderr, "enable: %s: no %s in %s\n", name, symbol, module);
+    dlclose(handle);
+    return 1;
+  }
+  if (plugin->abi_version < 1 || plugin->abi_version > SIMSH_PLUGIN_ABI_VERSION ||
+      plugin->main == NULL) {
+    fprintf(stderr, "enable: %s: unsupported builtin ABI version %d\n",
+            name, plugin->abi_version);
+    dlclose(handle);
+    return 1;
+  }
+
+  // a builtin loaded before under this name is replaced.
+  struct builtin *builtin = lookup_builtin(name);
+  if (builtin != NULL && builtin->plugin != NULL) {
+    unload_builtin(name);
+  }
+  builtin = add_builtin(name);
+  builtin->plugin = plugin;
+  builtin->handle = handle;
+  builtin->module = strdup(module);
+  table_generation++;
+  return 0;
+}
+
+
+// Remove the loaded builtin 'name', the utility of the shell it
+// replaced is used again. Returns 1 and prints a message if there's no
+// such builtin.
+static int unload_builtin(char *name) {
+  unsigned int bucket = hash_name(name);
+  struct builtin **link = &table[bucket];
+  while (*link != NULL && strcmp((*link)->name, name) != 0) {
+    link = &(*link)->next;
+  }
+
+  struct builtin *builtin = *link;
+  if (builtin == NULL || builtin->plugin == NULL) {
+    fprintf(stderr, "enable: %s: not a dynamically loaded builtin\n", name);
+    return 1;
+  }
+
+  // every builtin loaded from a module holds a reference to it.
+  dlclose(builtin->handle);
+  free(builtin->module);
+  builtin->plugin = NULL;
+  builtin->handle = NULL;
+  builtin->module = NULL;
+  if (builtin->function == NULL) {
+    *link = builtin->next;
+    free(builtin->name);
+    free(builtin);
+  }
+  table_generation++;
+  return 0;
+}
+
+
+static int compare_builtins(const void *a, const void *b) {
+  return strcmp((*(struct builtin **) a)->name, (*(struct builtin **) b)->name);
+}
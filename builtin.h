@@ -0,0 +1,51 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <sys/types.h>
+
+#include "parser.h"
+#include "execcache.h"
+
+// A utility run inside the shell instead of as a program, takes the
+// words of the command and returns its exit status.
+typedef int (*builtin_function)(char **argv);
+
+
+// An entry of the dispatch table, either one of the utilities of the
+// shell or a builtin loaded by 'enable -f'.
+struct builtin;
+
+
+// Returns the in-process implementation of the command 'argv', or NULL
+// if it has to be run as a program. These are echo, printf, test, '[',
+// true, false, cat, tee, basename, dirname and enable, and the builtins
+// loaded from modules; cat, tee, basename and dirname are run as
+// programs when given an option they don't implement.
+struct builtin *find_builtin(char **argv);
+
+
+// Returns the names of every builtin, the shell's own and those of the
+// dispatch table, as a malloc'ed array ending with NULL of malloc'ed
+// strings.
+char **get_builtin_names();
+
+
+// Returns a number which changes whenever a builtin is loaded or
+// unloaded, so the names got before are out of date.
+unsigned long get_builtins_generation();
+
+
+// Run a utility in the shell with the redirections of 'stage', which
+// are applied to the shell's own descriptors until it returns.
+// Returns its exit status.
+int run_builtin(struct builtin *builtin, char **argv, struct stage *stage);
+
+
+// Run a utility as a stage of a pipeline, in a child of the shell set
+// up like exec_cache_spawn sets up a program. Returns the pid of the
+// child, or -1 with errno set if it couldn't be forked.
+pid_t spawn_builtin(struct builtin *builtin, char **argv,
+                    struct fd_action *actions, int nactions,
+                    struct spawn_group *group);
+
+#endif
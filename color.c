@@ -1,12 +1,15 @@
 #include <stdio.h>
+
+#include "color.h"
+
 void green () {
-  printf("\033[1;32m");
+  printf(GREEN);
 }
 
 void blue () {
-  printf("\033[1;34m");
+  printf(BLUE);
 }
 
 void reset () {
-  printf("\033[0m");
+  printf(RESET);
 }
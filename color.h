@@ -1,3 +1,7 @@
+#define GREEN "\033[1;32m"
+#define BLUE "\033[1;34m"
+#define RESET "\033[0m"
+
 void green();
 
 void blue();
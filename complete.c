@@ -0,0 +1,622 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "builtin.h"
+#include "complete.h"
+
+#define INITIAL_NNODES 4096
+#define INITIAL_NENTRIES 64
+
+// the matches listed at most, the rest are only counted.
+#define MAX_LISTED 256
+
+// the directories files were completed in which are kept listed.
+#define NFILE_LISTINGS 8
+
+// A file of a directory listing.
+struct entry {
+  char *name;
+  // as in 'struct dirent'.
+  unsigned char type;
+};
+
+// The files of a directory sorted by name, and the state of the
+// directory when they were read.
+struct listing {
+  char *directory;
+  bool read;
+  struct timespec mtime;
+  ino_t ino;
+  // the directory was modified in the second it was read, it may have
+  // been modified again without its mtime changing.
+  bool racy;
+  struct entry *entries;
+  int nentries;
+  // the names, freed at once when the directory is read again.
+  struct arena arena;
+  // when it was last used, to replace the one used least recently.
+  unsigned long used;
+};
+
+// A node of the trie of the programs in the path, its children are a
+// list of siblings sorted by character. Nodes are never freed, a node
+// which no name goes through any more has a count of 0.
+struct trie_node {
+  // the number of names which go through the node, and the number of
+  // directories with a program named by the characters leading to it.
+  int count;
+  int terminal;
+  // indexes of the first child and of the next sibling, 0 if none.
+  int child;
+  int sibling;
+  char c;
+};
+
+
+static void update_path_trie();
+static void update_builtin_names(bool in_trie);
+static void free_names(char **names);
+static void update_listing(struct listing *listing, bool programs);
+static bool read_listing(struct listing *listing, bool programs);
+static int compare_entries(const void *a, const void *b);
+static struct listing *get_file_listing(char *directory);
+static void free_listing(struct listing *listing);
+static int trie_find(char *prefix);
+static int trie_child(int node, char c, bool add);
+static void trie_insert(char *name);
+static void trie_remove(char *name);
+static void trie_list(int node, char *name, int len, struct completion *completion);
+static bool complete_command(char *word, struct completion *completion);
+static bool complete_file(char *word, struct completion *completion);
+static int lower_bound(struct listing *listing, int lo, int hi, char *prefix,
+                       bool past_prefix);
+static bool is_directory(char *directory, struct entry *entry);
+
+// the builtins in the trie, completed like programs, and the
+// generation of the dispatch table they were got from.
+static char **builtin_names;
+static unsigned long builtins_generation;
+
+// the directories of the path and the programs in them.
+static struct listing *path_listings;
+static int npath_listings;
+static struct trie_node *nodes;
+static int nnodes;
+static int nodes_size;
+
+static struct listing file_listings[NFILE_LISTINGS];
+static unsigned long listings_used;
+
+// the completion returned last.
+static struct arena completion_arena = { NULL };
+
+
+void set_completion_path(char **path) {
+  for (int i = 0; i < npath_listings; i++) {
+    free_listing(&path_listings[i]);
+    free(path_listings[i].directory);
+  }
+  npath_listings = 0;
+  while (path[npath_listings] != NULL) {
+    npath_listings++;
+  }
+  path_listings = realloc(path_listings, sizeof(*path_listings) * (npath_listings + 1));
+  memset(path_listings, 0, sizeof(*path_listings) * npath_listings);
+  for (int i = 0; i < npath_listings; i++) {
+    path_listings[i].directory = strdup(path[i]);
+  }
+
+  // the trie is built again when a command is next completed.
+  nnodes = 0;
+}
+
+
+bool complete(char *line, size_t cursor, struct completion *completion) {
+  arena_reset(&completion_arena);
+  memset(completion, 0, sizeof(*completion));
+
+  // the word is broken by blanks and the operators which are always
+  // words of their own.
+  size_t start = cursor;
+  while (start > 0 && strchr(" \t|;&<>", line[start-1]) == NULL) {
+    start--;
+  }
+  completion->start = start;
+  char *word = arena_strndup(&completion_arena, &line[start], cursor - start);
+
+  // it's the first word of a command if only blanks come between it
+  // and the start of the line or a separator.
+  size_t before = start;
+  while (before > 0 && (line[before-1] == ' ' || line[before-1] == '\t')) {
+    before--;
+  }
+  bool command = (before == 0 || strchr("|;&", line[before-1]) != NULL);
+
+  if (command && word[0] != '~' && strchr(word, '/') == NULL) {
+    return complete_command(word, completion);
+  }
+  return complete_file(word, completion);
+}
+
+
+static bool complete_command(char *word, struct completion *completion) {
+  update_path_trie();
+
+  int node = trie_find(word);
+  if (node == -1 || nodes[node].count == 0) {
+    return false;
+  }
+  completion->nmatches = nodes[node].count;
+
+  // the matches share more than the word while the trie doesn't
+  // branch, the work is proportional to what's added.
+  size_t len = strlen(word);
+  char *common = arena_alloc(&completion_arena, len + NAME_MAX + 1);
+  memcpy(common, word, len);
+  while (nodes[node].terminal == 0) {
+    int only = 0;
+    int nlive = 0;
+    for (int child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+      if (nodes[child].count > 0) {
+        only = child;
+        nlive++;
+      }
+    }
+    if (nlive != 1 || len >= strlen(word) + NAME_MAX) {
+      break;
+    }
+    common[len++] = nodes[only].c;
+    node = only;
+  }
+  common[len] = '\0';
+  completion->common = common;
+  completion->unique = (nodes[node].count == 1);
+
+  completion->listed = arena_alloc(&completion_arena, sizeof(char *) * MAX_LISTED);
+  char name[len + NAME_MAX + 1];
+  memcpy(name, common, len);
+  trie_list(node, name, len, completion);
+  return true;
+}
+
+
+static bool complete_file(char *word, struct completion *completion) {
+  // the directory is the part up to the last '/', '~' is the home
+  // directory.
+  char directory[PATH_MAX];
+  char *slash = strrchr(word, '/');
+  char *base = (slash != NULL) ? slash + 1 : word;
+  if (slash == NULL) {
+    strcpy(directory, ".");
+  } else if (word[0] == '~' && word[1] == '/' && getenv("HOME") != NULL) {
+    snprintf(directory, sizeof(directory), "%s%.*s", getenv("HOME"),
+             (int)(slash - word), word + 1);
+  } else if (slash == word) {
+    strcpy(directory, "/");
+  } else {
+    snprintf(directory, sizeof(directory), "%.*s", (int)(slash - word), word);
+  }
+
+  struct listing *listing = get_file_listing(directory);
+  if (listing == NULL) {
+    return false;
+  }
+
+  // the matches are a range of the sorted names, without the hidden
+  // files unless the name starts with '.', which are a range too.
+  int ranges[2][2];
+  int nranges = 0;
+  int lo = lower_bound(listing, 0, listing->nentries, base, false);
+  int hi = lower_bound(listing, lo, listing->nentries, base, true);
+  if (base[0] == '.') {
+    ranges[nranges][0] = lo;
+    ranges[nranges++][1] = hi;
+  } else {
+    int hidden_lo = lower_bound(listing, lo, hi, ".", false);
+    int hidden_hi = lower_bound(listing, hidden_lo, hi, ".", true);
+    ranges[nranges][0] = lo;
+    ranges[nranges++][1] = hidden_lo;
+    ranges[nranges][0] = hidden_hi;
+    ranges[nranges++][1] = hi;
+  }
+
+  struct entry *first = NULL;
+  struct entry *last = NULL;
+  completion->listed = arena_alloc(&completion_arena, sizeof(char *) * MAX_LISTED);
+  for (int i = 0; i < nranges; i++) {
+    if (ranges[i][0] == ranges[i][1]) {
+      continue;
+    }
+    if (first == NULL) {
+      first = &listing->entries[ranges[i][0]];
+    }
+    last = &listing->entries[ranges[i][1] - 1];
+    completion->nmatches += ranges[i][1] - ranges[i][0];
+
+    for (int j = ranges[i][0]; j < ranges[i][1] && completion->nlisted < MAX_LISTED; j++) {
+      struct entry *entry = &listing->entries[j];
+      char *name = arena_alloc(&completion_arena, strlen(entry->name) + 2);
+      sprintf(name, "%s%s", entry->name, (entry->type == DT_DIR) ? "/" : "");
+      completion->listed[completion->nlisted++] = name;
+    }
+  }
+  if (first == NULL) {
+    return false;
+  }
+
+  // the names between the first and last match share what those two do.
+  size_t shared = 0;
+  while (first->name[shared] != '\0' && first->name[shared] == last->name[shared]) {
+    shared++;
+  }
+  size_t typed = base - word;
+  bool unique = (completion->nmatches == 1);
+  bool directory_match = unique && is_directory(directory, first);
+  char *common = arena_alloc(&completion_arena, typed + shared + 2);
+  sprintf(common, "%.*s%.*s%s", (int)typed, word, (int)shared, first->name,
+          directory_match ? "/" : "");
+  completion->common = common;
+  completion->unique = unique;
+  return true;
+}
+
+
+// Find the programs of every directory of the path which was modified
+// since it was read, and update the trie with the ones which were added
+// or removed. The trie is built with all of them the first time.
+static void update_path_trie() {
+  if (nnodes == 0) {
+    if (nodes == NULL) {
+      nodes_size = INITIAL_NNODES;
+      nodes = malloc(sizeof(*nodes) * nodes_size);
+    }
+    memset(&nodes[0], 0, sizeof(*nodes));
+    nnodes = 1;
+    for (int i = 0; i < npath_listings; i++) {
+      free_listing(&path_listings[i]);
+    }
+    update_builtin_names(false);
+  } else if (get_builtins_generation() != builtins_generation) {
+    update_builtin_names(true);
+  }
+
+  for (int i = 0; i < npath_listings; i++) {
+    update_listing(&path_listings[i], true);
+  }
+}
+
+
+// Put the names of the builtins into the trie, taking out the ones put
+// there before if they're still 'in_trie'.
+static void update_builtin_names(bool in_trie) {
+  if (builtin_names != NULL && in_trie) {
+    for (int i = 0; builtin_names[i] != NULL; i++) {
+      trie_remove(builtin_names[i]);
+    }
+  }
+  free_names(builtin_names);
+
+  builtins_generation = get_builtins_generation();
+  builtin_names = get_builtin_names();
+  for (int i = 0; builtin_names[i] != NULL; i++) {
+    trie_insert(builtin_names[i]);
+  }
+}
+
+
+static void free_names(char **names) {
+  if (names == NULL) {
+    return;
+  }
+  for (int i = 0; names[i] != NULL; i++) {
+    free(names[i]);
+  }
+  free(names);
+}
+
+
+// Read the listing of a directory of the path again if it was modified,
+// and put the changes into the trie.
+static void update_listing(struct listing *listing, bool programs) {
+  struct stat s;
+  if (stat(listing->directory, &s) == -1) {
+    s.st_mtim.tv_sec = 0;
+    s.st_mtim.tv_nsec = 0;
+    s.st_ino = 0;
+  }
+  if (listing->read && !listing->racy && listing->ino == s.st_ino &&
+      listing->mtime.tv_sec == s.st_mtim.tv_sec &&
+      listing->mtime.tv_nsec == s.st_mtim.tv_nsec) {
+    return;
+  }
+
+  struct listing old = *listing;
+  memset(&listing->arena, 0, sizeof(listing->arena));
+  listing->entries = NULL;
+  listing->nentries = 0;
+  if (s.st_ino == 0 || !read_listing(listing, programs)) {
+    listing->read = true;
+    listing->racy = false;
+    listing->mtime = s.st_mtim;
+    listing->ino = s.st_ino;
+  }
+
+  // both listings are sorted, merge them to find what changed.
+  int i = 0;
+  int j = 0;
+  while (i < old.nentries || j < listing->nentries) {
+    int order = (i == old.nentries) ? 1 : (j == listing->nentries) ? -1 :
+                strcmp(old.entries[i].name, listing->entries[j].name);
+    if (order < 0) {
+      trie_remove(old.entries[i++].name);
+    } else if (order > 0) {
+      trie_insert(listing->entries[j++].name);
+    } else {
+      i++;
+      j++;
+    }
+  }
+  free_listing(&old);
+}
+
+
+// Read the files of the directory of 'listing' sorted by name, only the
+// programs if 'programs' is true. Returns false if it can't be read.
+static bool read_listing(struct listing *listing, bool programs) {
+  DIR *dir = opendir(listing->directory);
+  if (dir == NULL) {
+    return false;
+  }
+
+  // the state is taken before reading, a change while it's read is
+  // seen the next time.
+  struct stat s;
+  if (fstat(dirfd(dir), &s) == -1) {
+    closedir(dir);
+    return false;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  listing->mtime = s.st_mtim;
+  listing->ino = s.st_ino;
+  listing->racy = (now.tv_sec <= s.st_mtim.tv_sec + 1);
+  listing->read = true;
+
+  int size = INITIAL_NENTRIES;
+  listing->entries = malloc(sizeof(*listing->entries) * size);
+  listing->nentries = 0;
+  struct dirent *dirent;
+  while ((dirent = readdir(dir)) != NULL) {
+    char *name = dirent->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    unsigned char type = dirent->d_type;
+    if (programs) {
+      // a link or an unknown type has to be looked at.
+      struct stat file;
+      if (type == DT_DIR ||
+          ((type == DT_LNK || type == DT_UNKNOWN) &&
+           (fstatat(dirfd(dir), name, &file, 0) == -1 || !S_ISREG(file.st_mode))) ||
+          faccessat(dirfd(dir), name, X_OK, 0) == -1) {
+        continue;
+      }
+    }
+
+    if (listing->nentries == size) {
+      size *= 2;
+      listing->entries = realloc(listing->entries, sizeof(*listing->entries) * size);
+    }
+    listing->entries[listing->nentries].name = arena_strdup(&listing->arena, name);
+    listing->entries[listing->nentries].type = type;
+    listing->nentries++;
+  }
+  closedir(dir);
+
+  qsort(listing->entries, listing->nentries, sizeof(*listing->entries),
+        compare_entries);
+  return true;
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const struct entry *)a)->name, ((const struct entry *)b)->name);
+}
+
+
+// Returns the listing of 'directory', read again if it was modified
+// since it was last read, or NULL if it can't be read.
+static struct listing *get_file_listing(char *directory) {
+  struct listing *listing = NULL;
+  for (int i = 0; i < NFILE_LISTINGS; i++) {
+    if (file_listings[i].directory != NULL &&
+        strcmp(file_listings[i].directory, directory) == 0) {
+      listing = &file_listings[i];
+      break;
+    }
+  }
+
+  if (listing == NULL) {
+    // the one used least recently makes room.
+    listing = &file_listings[0];
+    for (int i = 1; i < NFILE_LISTINGS; i++) {
+      if (file_listings[i].used < listing->used) {
+        listing = &file_listings[i];
+      }
+    }
+    free_listing(listing);
+    free(listing->directory);
+    listing->directory = strdup(directory);
+  }
+  listing->used = ++listings_used;
+
+  struct stat s;
+  if (stat(directory, &s) == -1) {
+    return NULL;
+  }
+  if (!listing->read || listing->racy || listing->ino != s.st_ino ||
+      listing->mtime.tv_sec != s.st_mtim.tv_sec ||
+      listing->mtime.tv_nsec != s.st_mtim.tv_nsec) {
+    free_listing(listing);
+    if (!read_listing(listing, false)) {
+      return NULL;
+    }
+  }
+  return listing;
+}
+
+
+static void free_listing(struct listing *listing) {
+  free(listing->entries);
+  listing->entries = NULL;
+  listing->nentries = 0;
+  arena_reset(&listing->arena);
+  listing->read = false;
+}
+
+
+// Returns the node 'prefix' leads to, or -1 if no name starts with it.
+static int trie_find(char *prefix) {
+  int node = 0;
+  for (char *c = prefix; *c != '\0' && node != -1; c++) {
+    node = trie_child(node, *c, false);
+  }
+  return node;
+}
+
+
+// Returns the child of 'node' for the character 'c', which is added if
+// there's none and 'add' is true, otherwise -1.
+static int trie_child(int node, char c, bool add) {
+  int previous = 0;
+  int child = nodes[node].child;
+  while (child != 0 && nodes[child].c < c) {
+    previous = child;
+    child = nodes[child].sibling;
+  }
+  if (child != 0 && nodes[child].c == c) {
+    return child;
+  }
+  if (!add) {
+    return -1;
+  }
+
+  if (nnodes == nodes_size) {
+    nodes_size *= 2;
+    nodes = realloc(nodes, sizeof(*nodes) * nodes_size);
+  }
+  int added = nnodes++;
+  memset(&nodes[added], 0, sizeof(*nodes));
+  nodes[added].c = c;
+  nodes[added].sibling = child;
+  if (previous == 0) {
+    nodes[node].child = added;
+  } else {
+    nodes[previous].sibling = added;
+  }
+  return added;
+}
+
+
+static void trie_insert(char *name) {
+  int node = trie_find(name);
+  if (node != -1 && nodes[node].terminal > 0) {
+    nodes[node].terminal++;
+    return;
+  }
+
+  node = 0;
+  nodes[node].count++;
+  for (char *c = name; *c != '\0'; c++) {
+    node = trie_child(node, *c, true);
+    nodes[node].count++;
+  }
+  nodes[node].terminal = 1;
+}
+
+
+static void trie_remove(char *name) {
+  int node = trie_find(name);
+  if (node == -1 || nodes[node].terminal == 0) {
+    return;
+  }
+  // the name is still there while another directory has it.
+  if (--nodes[node].terminal > 0) {
+    return;
+  }
+  node = 0;
+  nodes[node].count--;
+  for (char *c = name; *c != '\0'; c++) {
+    node = trie_child(node, *c, false);
+    nodes[node].count--;
+  }
+}
+
+
+// List the names below 'node' in order into 'completion', 'name' holds
+// the 'len' characters leading to it.
+static void trie_list(int node, char *name, int len, struct completion *completion) {
+  if (completion->nlisted == MAX_LISTED) {
+    return;
+  }
+  if (nodes[node].terminal > 0) {
+    completion->listed[completion->nlisted++] =
+      arena_strndup(&completion_arena, name, len);
+  }
+  if (len >= NAME_MAX) {
+    return;
+  }
+  for (int child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+    if (nodes[child].count > 0) {
+      name[len] = nodes[child].c;
+      trie_list(child, name, len + 1, completion);
+    }
+  }
+}
+
+
+// Returns the first entry between 'lo' and 'hi' which comes after
+// 'prefix', or if 'past_prefix' is true, after every name starting
+// with 'prefix'.
+static int lower_bound(struct listing *listing, int lo, int hi, char *prefix,
+                       bool past_prefix) {
+  size_t len = strlen(prefix);
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    char *name = listing->entries[mid].name;
+    int order = past_prefix ? strncmp(name, prefix, len) : strcmp(name, prefix);
+    if (order < 0 || (past_prefix && order == 0)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+// Returns true if 'entry' of 'directory' is a directory, or a link to
+// one.
+static bool is_directory(char *directory, struct entry *entry) {
+  if (entry->type == DT_DIR) {
+    return true;
+  }
+  if (entry->type != DT_LNK && entry->type != DT_UNKNOWN) {
+    return false;
+  }
+  char path[PATH_MAX];
+  struct stat s;
+  snprintf(path, sizeof(path), "%s/%s", directory, entry->name);
+  return stat(path, &s) == 0 && S_ISDIR(s.st_mode);
+}
@@ -0,0 +1,39 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The completions of the word before the cursor.
+struct completion {
+  // where the word starts in the line.
+  size_t start;
+  // the word extended by what all of the matches share, and whether
+  // it's the only match, then complete.
+  char *common;
+  bool unique;
+  // the number of matches, and the names of the first 'nlisted' of
+  // them in order, to be listed.
+  int nmatches;
+  char **listed;
+  int nlisted;
+};
+
+
+// Use the directories of 'path' to complete command names, the
+// programs in them are found again the next time one is completed.
+void set_completion_path(char **path);
+
+
+// Complete the word which ends at 'cursor' in 'line': the name of a
+// builtin, those loaded by 'enable -f' too, or of a program in the path
+// if it's the first word of a command and has no '/', otherwise a file
+// name. The programs of the
+// path are kept in a prefix trie, built when a command is first
+// completed and updated when a directory of the path is modified; the
+// listings of the directories files were completed in are kept sorted
+// and read again when they're modified. Returns false if there's no
+// match; what 'completion' points to is valid until the next call.
+bool complete(char *line, size_t cursor, struct completion *completion);
+
+#endif
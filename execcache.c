@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "execcache.h"
+
+// the number of programs remembered, at most this many descriptors
+// are kept open.
+#define EXEC_CACHE_SIZE 32
+
+// a program is kept open once it has been run this many times.
+#define EXEC_CACHE_THRESHOLD 2
+
+
+struct exec_entry {
+  // NULL if the entry isn't used.
+  char *path;
+  // O_PATH descriptor of the program, -1 until it's run often enough.
+  int fd;
+  // the inode's mtime when it was opened.
+  struct timespec mtime;
+  int uses;
+  unsigned long last_used;
+};
+
+
+static struct exec_entry entries[EXEC_CACHE_SIZE];
+static unsigned long clock_tick;
+
+// signals the shell ignores while it controls jobs, which programs
+// get back.
+static int job_control_signals[] = {
+  SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, 0
+};
+
+// errno of a failed exec, written by the vfork child which shares the
+// memory of the shell until it execs or exits.
+static volatile int exec_errno;
+
+
+static struct exec_entry *get_entry(char *path);
+static void free_entry(struct exec_entry *entry);
+static int get_exec_fd(char *path);
+static int move_above_targets(int fd, struct fd_action *actions, int nactions);
+static bool is_unchanged(struct exec_entry *entry);
+static pid_t spawn_fd(int exec_fd, char *path, char **argv, char **envp,
+                      struct fd_action *actions, int nactions,
+                      struct spawn_group *group);
+static pid_t spawn_path(char *path, char **argv, char **envp,
+                        struct fd_action *actions, int nactions,
+                        struct spawn_group *group);
+static int join_group(struct spawn_group *group);
+static int apply_actions(struct fd_action *actions, int nactions);
+static void close_exec_fds();
+
+
+pid_t exec_cache_spawn(char *path, char **argv, char **envp,
+                       struct fd_action *actions, int nactions,
+                       struct spawn_group *group) {
+  int exec_fd = get_exec_fd(path);
+  // an action could replace or close the descriptor before it's
+  // executed, a copy above every target is executed instead.
+  int cached_fd = exec_fd;
+  if (exec_fd != -1) {
+    exec_fd = move_above_targets(exec_fd, actions, nactions);
+  }
+
+  pid_t pid;
+  // posix_spawn can't hand over the terminal before the program runs,
+  // a foreground group is started from a vfork child too.
+  if (exec_fd != -1 || (group != NULL && group->terminal != -1)) {
+    pid = spawn_fd(exec_fd, path, argv, envp, actions, nactions, group);
+  } else {
+    pid = spawn_path(path, argv, envp, actions, nactions, group);
+  }
+
+  if (exec_fd != cached_fd && exec_fd != -1) {
+    int saved_errno = errno;
+    close(exec_fd);
+    errno = saved_errno;
+  }
+  return pid;
+}
+
+
+pid_t spawn_fork(struct fd_action *actions, int nactions,
+                 struct spawn_group *group) {
+  // the child runs no handler of the shell before it resets them.
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  sigprocmask(SIG_SETMASK, &all_signals, &old_signals);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (join_group(group) == -1 || apply_actions(actions, nactions) == -1) {
+      _exit(127);
+    }
+    for (int i = 0; job_control_signals[i] != 0; i++) {
+      signal(job_control_signals[i], SIG_DFL);
+    }
+    signal(SIGCHLD, SIG_DFL);
+    // a pipe end the child kept open would never see end of file.
+    close_exec_fds();
+    sigprocmask(SIG_SETMASK, &old_signals, NULL);
+    return 0;
+  }
+
+  int saved_errno = errno;
+  // unlike a vfork child, this one may not have joined the group yet
+  // when the next program of the pipeline is spawned into it.
+  if (pid != -1 && group != NULL) {
+    setpgid(pid, (group->pgid == 0) ? pid : group->pgid);
+  }
+  sigprocmask(SIG_SETMASK, &old_signals, NULL);
+  errno = saved_errno;
+  return pid;
+}
+
+
+void exec_cache_remove(char *path) {
+  for (int i = 0; i < EXEC_CACHE_SIZE; i++) {
+    if (entries[i].path != NULL && strcmp(entries[i].path, path) == 0) {
+      free_entry(&entries[i]);
+      return;
+    }
+  }
+}
+
+
+void exec_cache_clear() {
+  for (int i = 0; i < EXEC_CACHE_SIZE; i++) {
+    if (entries[i].path != NULL) {
+      free_entry(&entries[i]);
+    }
+  }
+}
+
+
+// Returns the entry of 'path', replacing the least recently used entry
+// with a new one if it isn't remembered.
+static struct exec_entry *get_entry(char *path) {
+  struct exec_entry *oldest = &entries[0];
+  for (int i = 0; i < EXEC_CACHE_SIZE; i++) {
+    struct exec_entry *entry = &entries[i];
+    if (entry->path != NULL && strcmp(entry->path, path) == 0) {
+      return entry;
+    }
+    if (entry->last_used < oldest->last_used) {
+      oldest = entry;
+    }
+  }
+
+  if (oldest->path != NULL) {
+    free_entry(oldest);
+  }
+  oldest->path = strdup(path);
+  oldest->fd = -1;
+  oldest->uses = 0;
+  return oldest;
+}
+
+
+static void free_entry(struct exec_entry *entry) {
+  if (entry->fd != -1) {
+    close(entry->fd);
+  }
+  free(entry->path);
+  entry->path = NULL;
+  entry->fd = -1;
+  entry->last_used = 0;
+}
+
+
+// Returns the descriptor to execute 'path' by, or -1 if it isn't run
+// often enough to be kept open.
+static int get_exec_fd(char *path) {
+  struct exec_entry *entry = get_entry(path);
+  entry->last_used = ++clock_tick;
+  entry->uses++;
+
+  if (entry->fd != -1 && !is_unchanged(entry)) {
+    close(entry->fd);
+    entry->fd = -1;
+  }
+
+  if (entry->fd == -1 && entry->uses >= EXEC_CACHE_THRESHOLD) {
+    entry->fd = open(path, O_PATH|O_CLOEXEC);
+
+    struct stat s;
+    if (entry->fd != -1 && (fstat(entry->fd, &s) == -1 || !S_ISREG(s.st_mode))) {
+      close(entry->fd);
+      entry->fd = -1;
+    } else if (entry->fd != -1) {
+      entry->mtime = s.st_mtim;
+    }
+  }
+  return entry->fd;
+}
+
+
+// Returns 'fd' if it's above the target of every action, else a
+// close-on-exec copy of it above them, or -1 if it couldn't be copied
+// and the program has to be run by its path.
+static int move_above_targets(int fd, struct fd_action *actions, int nactions) {
+  int highest = -1;
+  for (int i = 0; i < nactions; i++) {
+    if (actions[i].target > highest) {
+      highest = actions[i].target;
+    }
+  }
+  if (fd > highest) {
+    return fd;
+  }
+  return fcntl(fd, F_DUPFD_CLOEXEC, highest + 1);
+}
+
+
+// Returns true if the file kept open is still the program at its path,
+// which stops being so when it's modified, or unlinked since a new file
+// was renamed over it.
+static bool is_unchanged(struct exec_entry *entry) {
+  struct stat s;
+  return fstat(entry->fd, &s) == 0 && s.st_nlink > 0 &&
+         s.st_mtim.tv_sec == entry->mtime.tv_sec &&
+         s.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+
+// Spawn the program open as 'exec_fd' from a vfork child, or the one
+// at 'path' if 'exec_fd' is -1.
+static pid_t spawn_fd(int exec_fd, char *path, char **argv, char **envp,
+                      struct fd_action *actions, int nactions,
+                      struct spawn_group *group) {
+  // no signal handler may run in the child while it shares the
+  // memory of the shell.
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  sigprocmask(SIG_SETMASK, &all_signals, &old_signals);
+
+  exec_errno = 0;
+  pid_t pid = vfork();
+  if (pid == 0) {
+    if (join_group(group) == 0 && apply_actions(actions, nactions) == 0) {
+      // the child doesn't share the signal actions of the shell, only
+      // its memory.
+      for (int i = 0; job_control_signals[i] != 0; i++) {
+        signal(job_control_signals[i], SIG_DFL);
+      }
+      sigprocmask(SIG_SETMASK, &old_signals, NULL);
+      if (exec_fd != -1) {
+        fexecve(exec_fd, argv, envp);
+      }
+      // a script can't be run through a close-on-exec descriptor since
+      // its interpreter couldn't open it, run it by its path instead.
+      if (exec_fd == -1 || errno == ENOENT) {
+        execve(path, argv, envp);
+      }
+    }
+    exec_errno = errno;
+    _exit(127);
+  }
+
+  int saved_errno = errno;
+  sigprocmask(SIG_SETMASK, &old_signals, NULL);
+
+  if (pid == -1) {
+    errno = saved_errno;
+    return -1;
+  }
+  if (exec_errno != 0) {
+    waitpid(pid, NULL, 0);
+    errno = exec_errno;
+    return -1;
+  }
+  return pid;
+}
+
+
+// Spawn the program at 'path' through posix_spawn.
+static pid_t spawn_path(char *path, char **argv, char **envp,
+                        struct fd_action *actions, int nactions,
+                        struct spawn_group *group) {
+  posix_spawnattr_t attributes;
+  posix_spawn_file_actions_t file_actions;
+  int error = posix_spawnattr_init(&attributes);
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  error = posix_spawn_file_actions_init(&file_actions);
+  if (error != 0) {
+    posix_spawnattr_destroy(&attributes);
+    errno = error;
+    return -1;
+  }
+
+  sigset_t default_signals;
+  sigemptyset(&default_signals);
+  for (int i = 0; job_control_signals[i] != 0; i++) {
+    sigaddset(&default_signals, job_control_signals[i]);
+  }
+  short flags = POSIX_SPAWN_SETSIGDEF;
+  posix_spawnattr_setsigdefault(&attributes, &default_signals);
+  if (group != NULL) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attributes, group->pgid);
+  }
+  posix_spawnattr_setflags(&attributes, flags);
+
+  for (int i = 0; i < nactions && error == 0; i++) {
+    if (actions[i].fd == -1) {
+      error = posix_spawn_file_actions_addclose(&file_actions, actions[i].target);
+    } else {
+      error = posix_spawn_file_actions_adddup2(&file_actions, actions[i].fd,
+                                               actions[i].target);
+    }
+  }
+
+  pid_t pid = -1;
+  if (error == 0) {
+    error = posix_spawn(&pid, path, &file_actions, &attributes, argv, envp);
+  }
+  posix_spawn_file_actions_destroy(&file_actions);
+  posix_spawnattr_destroy(&attributes);
+
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return pid;
+}
+
+
+// Put the child in 'group' and give it the terminal, returns -1 if it
+// can't be.
+static int join_group(struct spawn_group *group) {
+  if (group == NULL) {
+    return 0;
+  }
+  if (setpgid(0, group->pgid) == -1) {
+    return -1;
+  }
+  // every signal is still blocked, the child isn't stopped by taking
+  // the terminal from the background.
+  if (group->terminal != -1 && tcsetpgrp(group->terminal, getpgrp()) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+
+// Apply 'actions' in the child, returns -1 if one of them fails.
+static int apply_actions(struct fd_action *actions, int nactions) {
+  for (int i = 0; i < nactions; i++) {
+    int fd = actions[i].fd;
+    int target = actions[i].target;
+
+    if (fd == -1) {
+      close(target);
+    } else if (fd == target) {
+      // already in place, it only has to survive the exec.
+      if (fcntl(fd, F_SETFD, 0) == -1) {
+        return -1;
+      }
+    } else if (dup2(fd, target) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+// Close the descriptors of the shell which an exec would, in a child
+// which doesn't exec.
+static void close_exec_fds() {
+  DIR *dir = opendir("/proc/self/fd");
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    int fd = atoi(entry->d_name);
+    int flags;
+    if (fd > STDERR_FILENO && fd != dirfd(dir) &&
+        (flags = fcntl(fd, F_GETFD)) != -1 && (flags & FD_CLOEXEC)) {
+      close(fd);
+    }
+  }
+  closedir(dir);
+}
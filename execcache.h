@@ -0,0 +1,53 @@
+#ifndef EXECCACHE_H
+#define EXECCACHE_H
+
+#include <sys/types.h>
+
+// Connect descriptor 'target' of a spawned program to 'fd', or close
+// 'target' if 'fd' is -1.
+struct fd_action {
+  int fd;
+  int target;
+};
+
+
+// The process group a spawned program is put in.
+struct spawn_group {
+  // the group to join, or 0 to start a new one led by the program.
+  pid_t pgid;
+  // the terminal to make the group the foreground group of, -1 if the
+  // group runs in the background.
+  int terminal;
+};
+
+
+// Spawn the program at 'path' with 'argv' and 'envp', applying
+// 'actions' in order in the child. Programs run more than once are
+// kept open as O_PATH descriptors and executed through them, so the
+// kernel doesn't resolve 'path' again. The program is put in 'group'
+// unless it's NULL, and starts with the job control signals set to
+// their default actions. Returns the pid of the child, or -1 with
+// errno set if it couldn't be spawned.
+pid_t exec_cache_spawn(char *path, char **argv, char **envp,
+                       struct fd_action *actions, int nactions,
+                       struct spawn_group *group);
+
+
+// Fork a copy of the shell set up the way exec_cache_spawn sets up a
+// program: in 'group', with 'actions' applied, the job control signals
+// at their defaults and the close-on-exec descriptors closed. Returns 0
+// in the child, which has to _exit, the pid of the child in the
+// parent, or -1 with errno set.
+pid_t spawn_fork(struct fd_action *actions, int nactions,
+                 struct spawn_group *group);
+
+
+// Forget the descriptor kept for 'path', call this when 'path' may
+// refer to another file.
+void exec_cache_remove(char *path);
+
+
+// Forget every descriptor kept.
+void exec_cache_clear();
+
+#endif
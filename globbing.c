@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <glob.h>
+
+#include "helper.h"
+#include "arena.h"
+#include "globbing.h"
+#include "globstar.h"
+
+
+bool glob_nosort = false;
+
+
+static char **glob_word(char **globbed_tokens, int *ntokens, int *size,
+                        char *token, int nremaining);
+static char **append_matches(char **globbed_tokens, int *ntokens, int *size,
+                             char *token, char **paths, size_t npaths,
+                             int nremaining);
+static char **grow_tokens(char **globbed_tokens, int ntokens, int *size,
+                          int needed);
+static bool has_glob_chars(char *token);
+
+
+char **globbing(char **tokens) {
+  int nwords = count_nwords(tokens);
+  int size = nwords + 1;
+  char **globbed_tokens = arena_alloc(&command_arena,
+                                      sizeof(*globbed_tokens) * size);
+  int ntokens = 0;
+
+  // iterate through all tokens, glob each of them and append matching
+  // words to the end of the array.
+  for (int i = 0; tokens[i] != NULL; i++) {
+    if (has_glob_chars(tokens[i])) {
+      globbed_tokens = glob_word(globbed_tokens, &ntokens, &size, tokens[i],
+                                 nwords - i - 1);
+    } else {
+      // a plain word is used as it is, without touching the filesystem.
+      globbed_tokens[ntokens++] = tokens[i];
+    }
+  }
+
+  globbed_tokens[ntokens] = NULL;
+  return globbed_tokens;
+}
+
+
+// Glob a word and append it to the end of an array of strings of
+// 'size' elements, keeping room for the 'nremaining' words after it.
+static char **glob_word(char **globbed_tokens, int *ntokens, int *size,
+                        char *token, int nremaining) {
+  if (is_globstar(token)) {
+    // glob() has no recursive matching, '**' is walked by globstar.
+    struct globstar_matches matches;
+    globstar(token, glob_nosort, &matches);
+    globbed_tokens = append_matches(globbed_tokens, ntokens, size, token,
+                                    matches.paths, matches.npaths, nremaining);
+    globstar_free(&matches);
+    return globbed_tokens;
+  }
+
+  int flags = GLOB_NOCHECK|GLOB_TILDE;
+  if (glob_nosort) {
+    flags |= GLOB_NOSORT;
+  }
+
+  glob_t matches;
+  if (glob(token, flags, NULL, &matches) != 0) {
+    matches.gl_pathc = 0;
+  }
+  globbed_tokens = append_matches(globbed_tokens, ntokens, size, token,
+                                  matches.gl_pathv, matches.gl_pathc,
+                                  nremaining);
+  globfree(&matches);
+  return globbed_tokens;
+}
+
+
+// Append the 'npaths' matches of 'token', or the token itself if there
+// are none, copying them into the command arena.
+static char **append_matches(char **globbed_tokens, int *ntokens, int *size,
+                             char *token, char **paths, size_t npaths,
+                             int nremaining) {
+  if (npaths == 0) {
+    // no matches, add back the original token.
+    globbed_tokens[(*ntokens)++] = token;
+    return globbed_tokens;
+  }
+
+  // has matches, append all matches to the array.
+  globbed_tokens = grow_tokens(globbed_tokens, *ntokens, size,
+                               *ntokens + npaths + nremaining + 1);
+  for (size_t i = 0; i < npaths; i++) {
+    globbed_tokens[(*ntokens)++] = arena_strdup(&command_arena, paths[i]);
+  }
+  return globbed_tokens;
+}
+
+
+// Make sure the array of 'size' elements holding 'ntokens' words has
+// 'needed' elements, it's moved to one twice as large until it does.
+static char **grow_tokens(char **globbed_tokens, int ntokens, int *size,
+                          int needed) {
+  if (needed <= *size) {
+    return globbed_tokens;
+  }
+
+  int new_size = *size;
+  while (new_size < needed) {
+    new_size *= 2;
+  }
+  char **larger = arena_alloc(&command_arena, sizeof(*larger) * new_size);
+  memcpy(larger, globbed_tokens, sizeof(*larger) * ntokens);
+  *size = new_size;
+  return larger;
+}
+
+
+// Returns true if the word has to be globbed.
+static bool has_glob_chars(char *token) {
+  return token[0] == '~' || strpbrk(token, "*?[") != NULL;
+}
@@ -0,0 +1,15 @@
+#include <stdbool.h>
+
+// Don't sort the matches of a pattern, which saves the time spent
+// sorting the entries of huge directories.
+extern bool glob_nosort;
+
+
+// Returns an array of strings, with the last element being 'NULL'.
+// 'tokens' is the output of the 'tokenize' function.
+// Replace every word containing '*', '?' or '[', or starting with '~',
+// by all of the words matching that word.
+// A '**' path component matches any number of directories.
+// If there are no matches, use the word unchanged.
+// The array and the matches are allocated from the command arena.
+char **globbing(char **tokens);
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "globstar.h"
+
+// the most threads reading directories at once.
+#define GLOBSTAR_MAX_THREADS 8
+
+// size of the buffer each thread reads directory entries into.
+#define DIRENT_BUFFER_SIZE (256 * 1024)
+
+
+// an entry as returned by getdents64.
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+
+// a growable array of malloc'ed paths.
+struct path_list {
+  char **paths;
+  size_t npaths;
+  size_t size;
+};
+
+
+// a directory waiting to be read.
+struct queued_dir {
+  // ends with '/' unless it's the current directory.
+  char *path;
+  // the length of the directory the walk started from, which the
+  // paths matched against the suffix of the pattern are relative to.
+  size_t base_length;
+};
+
+
+// state shared by the threads walking the directories.
+struct walk {
+  // what the path of an entry below a base directory has to match.
+  char *suffix;
+  // the number of components of 'suffix', zero if everything matches.
+  int ncomponents;
+  // only match directories, if the pattern ends with '**/'.
+  bool dirs_only;
+  // hidden entries are matched too, if the last component of the
+  // pattern starts with '.'. Hidden directories are never walked.
+  bool match_hidden;
+
+  pthread_mutex_t lock;
+  pthread_cond_t more_dirs;
+  // a stack of directories waiting to be read, so the tree is walked
+  // depth first and the queue stays small.
+  struct queued_dir *queue;
+  size_t nqueued;
+  size_t queue_size;
+  // the number of threads reading a directory, the walk is over once
+  // none is and the queue is empty.
+  int busy;
+};
+
+
+// a thread of the walk and the matches it found.
+struct walker {
+  pthread_t thread;
+  struct walk *walk;
+  struct path_list matches;
+};
+
+
+static char *find_globstar(char *pattern);
+static void *walk_directories(void *arg);
+static void read_directory(struct walk *walk, struct queued_dir *dir,
+                           char *buffer, struct path_list *matches);
+static void queue_dir(struct walk *walk, char *path, size_t base_length);
+static bool matches_suffix(struct walk *walk, struct queued_dir *dir,
+                           char *name, bool is_dir);
+static void add_path(struct path_list *list, char *path);
+static char *join_path(char *dir, char *name, char *end);
+static int compare_paths(const void *a, const void *b);
+static int count_threads();
+
+
+bool is_globstar(char *pattern) {
+  return find_globstar(pattern) != NULL;
+}
+
+
+size_t globstar(char *pattern, bool nosort, struct globstar_matches *matches) {
+  matches->paths = NULL;
+  matches->npaths = 0;
+
+  // split the pattern into the directories to start from, and what has
+  // to match below them.
+  char *star = find_globstar(pattern);
+  if (star == NULL) {
+    return 0;
+  }
+
+  struct walk walk;
+  walk.suffix = (star[2] == '/') ? star + 3 : star + 2;
+  walk.dirs_only = (star[2] == '/' && walk.suffix[0] == '\0');
+  walk.ncomponents = 0;
+  if (walk.suffix[0] != '\0') {
+    walk.ncomponents = 1;
+    for (char *c = walk.suffix; *c != '\0'; c++) {
+      walk.ncomponents += (*c == '/');
+    }
+  }
+  char *last = strrchr(walk.suffix, '/');
+  walk.match_hidden = ((last != NULL) ? last[1] : walk.suffix[0]) == '.';
+  walk.queue = NULL;
+  walk.nqueued = 0;
+  walk.queue_size = 0;
+  walk.busy = 0;
+  pthread_mutex_init(&walk.lock, NULL);
+  pthread_cond_init(&walk.more_dirs, NULL);
+
+  // 'dir/**/' matches 'dir/' itself too, as '**' matches zero
+  // directories.
+  struct path_list starts = { NULL, 0, 0 };
+  if (star == pattern) {
+    queue_dir(&walk, strdup(""), 0);
+  } else {
+    // the part before '**' may be a pattern itself, like '~/*/**'.
+    // GLOB_MARK adds back the '/' ending it.
+    size_t prefix_length = star - pattern;
+    if (prefix_length > 1) {
+      prefix_length--;
+    }
+    char *prefix = strndup(pattern, prefix_length);
+    glob_t dirs;
+    if (glob(prefix, GLOB_TILDE|GLOB_ONLYDIR|GLOB_MARK, NULL, &dirs) == 0) {
+      for (size_t i = 0; i < dirs.gl_pathc; i++) {
+        size_t length = strlen(dirs.gl_pathv[i]);
+        if (length > 0 && dirs.gl_pathv[i][length-1] == '/') {
+          queue_dir(&walk, strdup(dirs.gl_pathv[i]), length);
+          if (walk.dirs_only) {
+            add_path(&starts, strdup(dirs.gl_pathv[i]));
+          }
+        }
+      }
+    }
+    globfree(&dirs);
+    free(prefix);
+  }
+
+  int nthreads = count_threads();
+  struct walker walkers[GLOBSTAR_MAX_THREADS];
+  int nstarted = 0;
+  for (int i = 0; i < nthreads; i++) {
+    walkers[i].walk = &walk;
+    walkers[i].matches = (struct path_list) { NULL, 0, 0 };
+    if (i > 0 && pthread_create(&walkers[i].thread, NULL, walk_directories,
+                                &walkers[i]) != 0) {
+      break;
+    }
+    nstarted++;
+  }
+  // the shell itself is the first walker.
+  walk_directories(&walkers[0]);
+
+  // merge the matches of every walker.
+  size_t npaths = starts.npaths;
+  for (int i = 0; i < nstarted; i++) {
+    if (i > 0) {
+      pthread_join(walkers[i].thread, NULL);
+    }
+    npaths += walkers[i].matches.npaths;
+  }
+
+  if (npaths > 0) {
+    matches->paths = malloc(sizeof(char *) * npaths);
+    memcpy(matches->paths, starts.paths, sizeof(char *) * starts.npaths);
+    matches->npaths = starts.npaths;
+    for (int i = 0; i < nstarted; i++) {
+      memcpy(matches->paths + matches->npaths, walkers[i].matches.paths,
+             sizeof(char *) * walkers[i].matches.npaths);
+      matches->npaths += walkers[i].matches.npaths;
+    }
+    if (!nosort) {
+      qsort(matches->paths, matches->npaths, sizeof(char *), compare_paths);
+    }
+  }
+
+  for (int i = 0; i < nstarted; i++) {
+    free(walkers[i].matches.paths);
+  }
+  free(starts.paths);
+  free(walk.queue);
+  pthread_mutex_destroy(&walk.lock);
+  pthread_cond_destroy(&walk.more_dirs);
+  return matches->npaths;
+}
+
+
+void globstar_free(struct globstar_matches *matches) {
+  for (size_t i = 0; i < matches->npaths; i++) {
+    free(matches->paths[i]);
+  }
+  free(matches->paths);
+  matches->paths = NULL;
+  matches->npaths = 0;
+}
+
+
+// Returns the first '**' of 'pattern' which is a whole path component,
+// or NULL if there is none.
+static char *find_globstar(char *pattern) {
+  for (char *p = strstr(pattern, "**"); p != NULL; p = strstr(p + 1, "**")) {
+    bool starts_component = (p == pattern || p[-1] == '/');
+    bool ends_component = (p[2] == '\0' || p[2] == '/');
+    if (starts_component && ends_component) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+
+// Read directories from the queue of the walk until there are none
+// left and no other thread may add one.
+static void *walk_directories(void *arg) {
+  struct walker *walker = arg;
+  struct walk *walk = walker->walk;
+  char *buffer = malloc(DIRENT_BUFFER_SIZE);
+
+  pthread_mutex_lock(&walk->lock);
+  while (true) {
+    while (walk->nqueued == 0 && walk->busy > 0) {
+      pthread_cond_wait(&walk->more_dirs, &walk->lock);
+    }
+    if (walk->nqueued == 0) {
+      // wake up the threads still waiting, there is nothing more to do.
+      pthread_cond_broadcast(&walk->more_dirs);
+      break;
+    }
+
+    struct queued_dir dir = walk->queue[--walk->nqueued];
+    walk->busy++;
+    pthread_mutex_unlock(&walk->lock);
+
+    if (buffer != NULL) {
+      read_directory(walk, &dir, buffer, &walker->matches);
+    }
+    free(dir.path);
+
+    pthread_mutex_lock(&walk->lock);
+    walk->busy--;
+  }
+  pthread_mutex_unlock(&walk->lock);
+
+  free(buffer);
+  return NULL;
+}
+
+
+// Read the entries of 'dir', adding the ones matching to 'matches' and
+// the directories among them to the queue of the walk.
+static void read_directory(struct walk *walk, struct queued_dir *dir,
+                           char *buffer, struct path_list *matches) {
+  char *path = dir->path;
+  int fd = open(path[0] != '\0' ? path : ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+
+  struct path_list subdirs = { NULL, 0, 0 };
+  long nread;
+  while ((nread = syscall(SYS_getdents64, fd, buffer, DIRENT_BUFFER_SIZE)) > 0) {
+    for (long offset = 0; offset < nread; ) {
+      struct linux_dirent64 *entry = (struct linux_dirent64 *) (buffer + offset);
+      offset += entry->d_reclen;
+
+      char *name = entry->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        continue;
+      }
+      bool hidden = (name[0] == '.');
+      if (hidden && !walk->match_hidden) {
+        continue;
+      }
+
+      bool is_dir = (entry->d_type == DT_DIR);
+      if (entry->d_type == DT_UNKNOWN) {
+        // the filesystem doesn't tell the type, it has to be looked up.
+        struct stat s;
+        is_dir = (fstatat(fd, name, &s, AT_SYMLINK_NOFOLLOW) == 0 &&
+                  S_ISDIR(s.st_mode));
+      }
+
+      if (matches_suffix(walk, dir, name, is_dir)) {
+        add_path(matches, join_path(path, name, walk->dirs_only ? "/" : ""));
+      }
+      if (is_dir && !hidden) {
+        add_path(&subdirs, join_path(path, name, "/"));
+      }
+    }
+  }
+  close(fd);
+
+  if (subdirs.npaths > 0) {
+    pthread_mutex_lock(&walk->lock);
+    for (size_t i = 0; i < subdirs.npaths; i++) {
+      queue_dir(walk, subdirs.paths[i], dir->base_length);
+    }
+    pthread_cond_broadcast(&walk->more_dirs);
+    pthread_mutex_unlock(&walk->lock);
+  }
+  free(subdirs.paths);
+}
+
+
+static void queue_dir(struct walk *walk, char *path, size_t base_length) {
+  if (walk->nqueued == walk->queue_size) {
+    walk->queue_size = (walk->queue_size > 0) ? walk->queue_size * 2 : 64;
+    walk->queue = realloc(walk->queue, sizeof(*walk->queue) * walk->queue_size);
+  }
+  walk->queue[walk->nqueued].path = path;
+  walk->queue[walk->nqueued].base_length = base_length;
+  walk->nqueued++;
+}
+
+
+// Returns true if the entry 'name' of 'dir' matches the suffix of the
+// pattern, with as many of the directories below the base as the
+// suffix has components.
+static bool matches_suffix(struct walk *walk, struct queued_dir *dir,
+                           char *name, bool is_dir) {
+  if (walk->dirs_only) {
+    return is_dir;
+  }
+  if (walk->ncomponents == 0) {
+    return true;
+  }
+  if (walk->ncomponents == 1) {
+    return fnmatch(walk->suffix, name, FNM_PERIOD) == 0;
+  }
+
+  // find the start of the last 'ncomponents - 1' directories.
+  char *relative = dir->path + dir->base_length;
+  int ndirs = walk->ncomponents - 1;
+  int nslashes = 0;
+  char *start = NULL;
+  for (char *c = relative + strlen(relative); c > relative; c--) {
+    if (c[-1] == '/' && ++nslashes == ndirs + 1) {
+      start = c;
+      break;
+    }
+  }
+  if (start == NULL) {
+    if (nslashes < ndirs) {
+      return false;
+    }
+    start = relative;
+  }
+
+  char *path = join_path(start, name, "");
+  bool matched = (fnmatch(walk->suffix, path, FNM_PATHNAME|FNM_PERIOD) == 0);
+  free(path);
+  return matched;
+}
+
+
+static void add_path(struct path_list *list, char *path) {
+  if (list->npaths == list->size) {
+    list->size = (list->size > 0) ? list->size * 2 : 64;
+    list->paths = realloc(list->paths, sizeof(char *) * list->size);
+  }
+  list->paths[list->npaths++] = path;
+}
+
+
+// Returns a malloc'ed 'dir' followed by 'name' and 'end'.
+static char *join_path(char *dir, char *name, char *end) {
+  size_t dir_length = strlen(dir);
+  size_t name_length = strlen(name);
+  size_t end_length = strlen(end);
+  char *path = malloc(dir_length + name_length + end_length + 1);
+  memcpy(path, dir, dir_length);
+  memcpy(path + dir_length, name, name_length);
+  memcpy(path + dir_length + name_length, end, end_length + 1);
+  return path;
+}
+
+
+static int compare_paths(const void *a, const void *b) {
+  return strcoll(*(char **) a, *(char **) b);
+}
+
+
+// Returns the number of threads to walk with, one per processor.
+static int count_threads() {
+  long nprocessors = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nprocessors < 1) {
+    return 1;
+  }
+  return (nprocessors < GLOBSTAR_MAX_THREADS) ? nprocessors
+                                                : GLOBSTAR_MAX_THREADS;
+}
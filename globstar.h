@@ -0,0 +1,37 @@
+#ifndef GLOBSTAR_H
+#define GLOBSTAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The paths matched by a '**' pattern.
+struct globstar_matches {
+  char **paths;
+  size_t npaths;
+};
+
+
+// Returns true if 'pattern' has a '**' path component.
+bool is_globstar(char *pattern);
+
+
+//
+// Expand a pattern with a '**' path component, which matches zero or
+// more directories; 'src/**/*.c' matches every '.c' file under 'src',
+// 'src/**' everything under it, and 'src/**/' 'src/' and every
+// directory under it. Only the first '**' is recursive.
+//
+// The directories are read in large getdents64 batches by a small pool
+// of threads, each taking the next directory to read from a shared
+// queue, and the matches of every thread are merged at the end.
+// Hidden files and symbolic links to directories aren't descended into.
+//
+// Returns the number of matches, sorted unless 'nosort' is true; they
+// are released with 'globstar_free'.
+//
+size_t globstar(char *pattern, bool nosort, struct globstar_matches *matches);
+
+
+void globstar_free(struct globstar_matches *matches);
+
+#endif
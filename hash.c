@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+
+#define HASH_BUCKETS 256
+
+
+// A program name mapped to where it was found in the path.
+struct hash_entry {
+  char *program;
+  // NULL if the program wasn't found in any directory.
+  char *executable_path;
+  // index of the directory in the path the program was found in.
+  int dir_index;
+  // mtime of the directory the program was found in, or the newest
+  // mtime among all the directories if it wasn't found.
+  struct timespec mtime;
+  int hits;
+  struct hash_entry *next;
+};
+
+
+static struct hash_entry *buckets[HASH_BUCKETS];
+
+// the path the entries were resolved against.
+static char **hashed_path;
+
+
+static unsigned int hash_string(char *s);
+static struct hash_entry **find_entry(char *program);
+static void free_entry(struct hash_entry *entry);
+static struct hash_entry *new_entry(char **path, char *program);
+static bool get_mtime(char *dir, struct timespec *mtime);
+static void get_newest_mtime(char **path, struct timespec *newest);
+static int compare_timespec(struct timespec *a, struct timespec *b);
+static bool is_stale(struct hash_entry *entry);
+
+
+int hash_lookup(char **path, char *program, char *executable_path) {
+  // every entry is meaningless once the path changes.
+  if (path != hashed_path) {
+    hash_clear();
+    return HASH_MISS;
+  }
+
+  struct hash_entry **entryp = find_entry(program);
+  struct hash_entry *entry = *entryp;
+  if (entry == NULL) {
+    return HASH_MISS;
+  }
+
+  if (is_stale(entry)) {
+    *entryp = entry->next;
+    free_entry(entry);
+    return HASH_MISS;
+  }
+
+  if (entry->executable_path == NULL) {
+    return HASH_NOT_FOUND;
+  }
+
+  entry->hits++;
+  strcpy(executable_path, entry->executable_path);
+  return HASH_FOUND;
+}
+
+
+void hash_insert(char **path, char *program, char *executable_path,
+                 int dir_index) {
+  struct hash_entry *entry = new_entry(path, program);
+  entry->executable_path = strdup(executable_path);
+  entry->dir_index = dir_index;
+  entry->hits = 1;
+  if (!get_mtime(path[dir_index], &entry->mtime)) {
+    // can't validate it later, don't keep it.
+    hash_remove(program);
+  }
+}
+
+
+void hash_insert_not_found(char **path, char *program) {
+  struct hash_entry *entry = new_entry(path, program);
+  get_newest_mtime(path, &entry->mtime);
+}
+
+
+bool hash_remove(char *program) {
+  struct hash_entry **entryp = find_entry(program);
+  struct hash_entry *entry = *entryp;
+  if (entry == NULL) {
+    return false;
+  }
+  *entryp = entry->next;
+  free_entry(entry);
+  return true;
+}
+
+
+void hash_clear() {
+  for (int i = 0; i < HASH_BUCKETS; i++) {
+    struct hash_entry *entry = buckets[i];
+    while (entry != NULL) {
+      struct hash_entry *next = entry->next;
+      free_entry(entry);
+      entry = next;
+    }
+    buckets[i] = NULL;
+  }
+  hashed_path = NULL;
+}
+
+
+void hash_print() {
+  bool empty = true;
+  for (int i = 0; i < HASH_BUCKETS; i++) {
+    for (struct hash_entry *entry = buckets[i]; entry; entry = entry->next) {
+      // programs that weren't found are only cached, not hashed.
+      if (entry->executable_path == NULL) continue;
+
+      if (empty) {
+        printf("hits\tcommand\n");
+        empty = false;
+      }
+      printf("%4d\t%s\n", entry->hits, entry->executable_path);
+    }
+  }
+
+  if (empty) {
+    fprintf(stderr, "hash: hash table empty\n");
+  }
+}
+
+
+// FNV-1a hash of a string.
+static unsigned int hash_string(char *s) {
+  unsigned int hash = 2166136261u;
+  for (; *s != '\0'; s++) {
+    hash ^= (unsigned char)*s;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+
+// Returns the link pointing to the entry of 'program', the link
+// points to NULL if there's no such entry.
+static struct hash_entry **find_entry(char *program) {
+  struct hash_entry **entryp = &buckets[hash_string(program) % HASH_BUCKETS];
+  while (*entryp != NULL && strcmp((*entryp)->program, program) != 0) {
+    entryp = &(*entryp)->next;
+  }
+  return entryp;
+}
+
+
+static void free_entry(struct hash_entry *entry) {
+  free(entry->program);
+  free(entry->executable_path);
+  free(entry);
+}
+
+
+// Add an empty entry for 'program', replacing the existing one.
+static struct hash_entry *new_entry(char **path, char *program) {
+  if (path != hashed_path) {
+    hash_clear();
+    hashed_path = path;
+  }
+  hash_remove(program);
+
+  struct hash_entry *entry = calloc(1, sizeof(*entry));
+  entry->program = strdup(program);
+
+  struct hash_entry **bucket = &buckets[hash_string(program) % HASH_BUCKETS];
+  entry->next = *bucket;
+  *bucket = entry;
+  return entry;
+}
+
+
+static bool get_mtime(char *dir, struct timespec *mtime) {
+  struct stat s;
+  if (stat(dir, &s) != 0) {
+    return false;
+  }
+  *mtime = s.st_mtim;
+  return true;
+}
+
+
+// Save the newest mtime among the directories in 'path' into 'newest',
+// directories that don't exist are skipped.
+static void get_newest_mtime(char **path, struct timespec *newest) {
+  newest->tv_sec = 0;
+  newest->tv_nsec = 0;
+
+  struct timespec mtime;
+  for (int i = 0; path[i] != NULL; i++) {
+    if (get_mtime(path[i], &mtime) && compare_timespec(&mtime, newest) > 0) {
+      *newest = mtime;
+    }
+  }
+}
+
+
+static int compare_timespec(struct timespec *a, struct timespec *b) {
+  if (a->tv_sec != b->tv_sec) {
+    return a->tv_sec < b->tv_sec ? -1 : 1;
+  }
+  if (a->tv_nsec != b->tv_nsec) {
+    return a->tv_nsec < b->tv_nsec ? -1 : 1;
+  }
+  return 0;
+}
+
+
+// An entry is stale once the directory it was found in changes, or,
+// for a program that wasn't found, once any directory in the path
+// changes since the program could have been added there.
+static bool is_stale(struct hash_entry *entry) {
+  struct timespec mtime;
+
+  if (entry->executable_path != NULL) {
+    return !get_mtime(hashed_path[entry->dir_index], &mtime) ||
+           compare_timespec(&mtime, &entry->mtime) != 0;
+  }
+
+  for (int i = 0; hashed_path[i] != NULL; i++) {
+    if (get_mtime(hashed_path[i], &mtime) &&
+        compare_timespec(&mtime, &entry->mtime) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,35 @@
+#include <stdbool.h>
+
+// Results of looking a program up in the command hash table.
+#define HASH_MISS 0
+#define HASH_FOUND 1
+#define HASH_NOT_FOUND 2
+
+
+// Looks up 'program' in the command hash table. Returns HASH_FOUND and
+// copies the cached location into 'executable_path' on a hit,
+// HASH_NOT_FOUND if the program is known to be absent from 'path', or
+// HASH_MISS if the entry is unknown or stale and 'path' must be searched.
+int hash_lookup(char **path, char *program, char *executable_path);
+
+
+// Remember that 'program' lives at 'executable_path', found in the
+// directory path[dir_index].
+void hash_insert(char **path, char *program, char *executable_path,
+                 int dir_index);
+
+
+// Remember that 'program' can't be found in any directory of 'path'.
+void hash_insert_not_found(char **path, char *program);
+
+
+// Forget the location of 'program', returns false if it wasn't hashed.
+bool hash_remove(char *program);
+
+
+// Forget every hashed location.
+void hash_clear();
+
+
+// Prints every hashed program with its number of hits.
+void hash_print();
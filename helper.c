@@ -11,6 +11,11 @@
 
 #include "helper.h"
 
+// the builtins the shell runs itself.
+static char *builtin_commands[] = {
+  "cd", "pwd", "history", "hash", "pipestatus", "set", "jobs", "fg", "bg",
+  "time", "wait", "parallel", "exit", NULL,
+};
 
 int is_integer(char *string) {
   for (int i = 0; string[i] != '\0'; i++) {
@@ -24,16 +29,6 @@ int is_integer(char *string) {
 }
 
 
-int is_pipes(char **tokens) {
-  for (int i = 0; tokens[i] != NULL; i++) {
-    if (strcmp(tokens[i], "|") == 0) {
-      return true;
-    }
-  }
-  return false;
-}
-
-
 int count_nwords(char **words) {
   int count = 0;
   for (int i = 0; words[i] != NULL; i++) {
@@ -49,15 +44,17 @@ void print_too_many_arguments(char *program) {
 
 
 int is_builtin_command(char *command) {
-  if (strcmp(command, "cd") == 0) {
-    return 1;
-  } else if (strcmp(command, "pwd") == 0) {
-    return 1;
-  } else if (strcmp(command, "history") == 0) {
-    return 1;
-  } else {
-    return 0;
+  for (int i = 0; builtin_commands[i] != NULL; i++) {
+    if (strcmp(command, builtin_commands[i]) == 0) {
+      return 1;
+    }
   }
+  return 0;
+}
+
+
+char **get_builtin_commands() {
+  return builtin_commands;
 }
 
 bool startsWith(const char *pre, const char *str) {
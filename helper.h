@@ -3,10 +3,6 @@
 int is_integer(char *string);
 
 
-// Returns true if the command includes piping.
-int is_pipes(char **tokens);
-
-
 // Returns # word in an array of words.
 int count_nwords(char **words);
 
@@ -18,5 +14,9 @@ void print_too_many_arguments(char *program);
 // Returns true if the command is a builtin command.
 int is_builtin_command(char *command);
 
+
+// Returns the names of the builtin commands, ending with NULL.
+char **get_builtin_commands();
+
 // Returns true if str starts with pre.
 bool startsWith(const char *pre, const char *str);
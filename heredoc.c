@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "lineedit.h"
+#include "heredoc.h"
+
+// the prompt for the lines of a here-document.
+#define HERE_DOCUMENT_PROMPT "> "
+
+
+static char *read_body(char *word, bool strip_tabs, FILE *input, bool prompt);
+static char *get_delimiter(char *word);
+static int write_body(int fd, char *body, size_t length);
+
+
+void read_here_documents(struct command_list *list, FILE *input, bool prompt) {
+  for (int i = 0; i < list->npipelines; i++) {
+    struct pipeline *pipeline = &list->pipelines[i];
+    for (int j = 0; j < pipeline->nstages; j++) {
+      struct stage *stage = &pipeline->stages[j];
+      for (int k = 0; k < stage->nredirections; k++) {
+        struct redirection *redirection = &stage->redirections[k];
+
+        switch (redirection->type) {
+        case REDIRECT_HERE_DOCUMENT:
+        case REDIRECT_HERE_DOCUMENT_INDENTED:
+          redirection->body = read_body(
+              redirection->target,
+              redirection->type == REDIRECT_HERE_DOCUMENT_INDENTED,
+              input, prompt);
+          break;
+        case REDIRECT_HERE_STRING: {
+          // the word ends with a newline, like a line of a file.
+          size_t length = strlen(redirection->target);
+          redirection->body = arena_alloc(&command_arena, length + 2);
+          strcpy(stpcpy(redirection->body, redirection->target), "\n");
+          break;
+        }
+        default:
+          break;
+        }
+      }
+    }
+  }
+}
+
+
+int open_here_document(char *body) {
+  size_t length = strlen(body);
+
+  // a body which fits in a pipe is written to it at once, without
+  // blocking, and needs nothing but the pipe.
+  if (length <= PIPE_BUF) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+      return -1;
+    }
+    if (write_body(fds[1], body, length) == -1) {
+      int saved_errno = errno;
+      close(fds[0]);
+      close(fds[1]);
+      errno = saved_errno;
+      return -1;
+    }
+    close(fds[1]);
+    return fds[0];
+  }
+
+  // sealed, the command can't change what another reading it sees.
+  int fd = memfd_create("here-document", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+  if (fd == -1) {
+    return -1;
+  }
+  if (write_body(fd, body, length) == -1 ||
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) == -1 ||
+      lseek(fd, 0, SEEK_SET) == -1) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+
+// Returns the lines of 'input' up to the one which is the delimiter
+// 'word', allocated from the command arena. Leading tabs are removed
+// from every line if 'strip_tabs' is true.
+static char *read_body(char *word, bool strip_tabs, FILE *input, bool prompt) {
+  char *delimiter = get_delimiter(word);
+
+  char *body;
+  size_t body_size;
+  FILE *stream = open_memstream(&body, &body_size);
+  if (stream == NULL) {
+    perror("open_memstream");
+    return "";
+  }
+
+  bool found = false;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t length;
+  while (!found && input != NULL) {
+    // the lines typed on a terminal are edited like commands.
+    if (prompt) {
+      length = edit_line(HERE_DOCUMENT_PROMPT, &line, &line_size);
+    } else {
+      length = getline(&line, &line_size, input);
+    }
+    if (length == -1) {
+      break;
+    }
+
+    char *text = line;
+    if (strip_tabs) {
+      text += strspn(text, "\t");
+    }
+    // the delimiter may be the last line without a newline.
+    size_t text_length = length - (text - line);
+    size_t delimiter_length = strlen(delimiter);
+    found = (strncmp(text, delimiter, delimiter_length) == 0 &&
+             (text_length == delimiter_length ||
+              (text_length == delimiter_length + 1 && text[delimiter_length] == '\n')));
+    if (!found) {
+      fwrite(text, 1, text_length, stream);
+    }
+  }
+  free(line);
+  fclose(stream);
+
+  if (!found) {
+    fprintf(stderr, "warning: here-document delimited by end-of-file "
+                    "(wanted `%s')\n", delimiter);
+  }
+  char *copy = arena_strndup(&command_arena, body, body_size);
+  free(body);
+  return copy;
+}
+
+
+// Returns the delimiter a here-document ends at, 'word' without the
+// quotes around it or its parts, as in <<'EOF'.
+static char *get_delimiter(char *word) {
+  char *delimiter = arena_strdup(&command_arena, word);
+  char *end = delimiter;
+  for (char *c = word; *c != '\0'; c++) {
+    if (*c != '\'' && *c != '"') {
+      *end++ = *c;
+    }
+  }
+  *end = '\0';
+  return delimiter;
+}
+
+
+// Write all of 'body' to 'fd', returns -1 with errno set if it fails.
+static int write_body(int fd, char *body, size_t length) {
+  for (size_t written = 0; written < length; ) {
+    ssize_t n = write(fd, body + written, length - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      return -1;
+    }
+    written += n;
+  }
+  return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef HEREDOC_H
+#define HEREDOC_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "parser.h"
+
+//
+// Here-documents and here-strings, which give a command its stdin
+// from the command line itself:
+//
+//     % cat <<EOF
+//     > any text
+//     > EOF
+//     % wc -c <<< word
+//
+// A here-string takes exactly one word, and a newline is added to it.
+//
+// The body is handed to the command in a sealed memory file, or in a
+// pipe written beforehand if it's small, and never touches the disk.
+//
+
+
+// Read the bodies of the here-documents of 'list' from the lines of
+// 'input' after the command line, in order, and save the body of every
+// here-document and here-string into its redirection. '>' is printed
+// before every line if 'prompt' is true. A body cut off by the end of
+// the input, or with no input, is kept as it is with a warning.
+void read_here_documents(struct command_list *list, FILE *input, bool prompt);
+
+
+// Returns a descriptor to read 'body' from, close-on-exec, or -1 with
+// errno set.
+int open_here_document(char *body);
+
+#endif
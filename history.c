@@ -1,81 +1,224 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
-#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "helper.h"
 #include "history.h"
+#include "suggest.h"
+#include "arena.h"
+
+#define INITIAL_TEXT_SIZE 4096
+#define INITIAL_NENTRIES 256
+
+// the history file is searched from the end in chunks of this size.
+#define SEARCH_CHUNK_SIZE (1 << 20)
 
 
 static int get_starting_line_number(char *asciiNumber, int nlines);
+static void load_history();
+static void append_entry(char *line, size_t len);
+static void flush_history_at_exit();
+static size_t count_newlines(const char *s, size_t len);
+static char *find_substring(char *s, size_t len, char *needle, size_t needle_len);
+static void search_chunk(char *text, size_t lo, size_t hi, size_t line_number,
+                         char *pattern, bool prefix);
+
+static bool history_enabled = true;
+
+// Every entry of the history, kept in memory after the .cowrie_history
+// file is read once. 'history_text' holds the entries back to back,
+// each ending with '\n', and entry i starts at offsets[i]; offsets[i+1]
+// is always the end of entry i.
+static bool history_loaded = false;
+static char *history_text;
+static size_t text_len;
+static size_t text_size;
+static size_t *offsets;
+static int nentries;
+static int offsets_size;
+
+// new entries are appended to the file through this buffered stream.
+static FILE *history_fp;
+static bool missing_newline = false;
 
 
 char *get_history_path() {
+  static char *history_path;
+  if (history_path != NULL) {
+    return history_path;
+  }
+
   char *home_path = getenv("HOME");
-  assert(home_path != NULL);
+  if (home_path == NULL) {
+    return NULL;
+  }
 
   char *basename = ".cowrie_history";
   int path_len = strlen(home_path) + strlen(basename) + 2;
-  char *history_path = malloc(sizeof(char) * path_len);
+  history_path = malloc(sizeof(char) * path_len);
 
   snprintf(history_path, path_len, "%s/%s",
            home_path, basename);
-  
+
   return history_path;
 }
 
 
 void print_history(char *asciiNumber) {
-  FILE *fp = fopen(get_history_path(), "r");
-  if (fp != NULL) {
-
-    int nlines = get_nlines();
-    // Get the line to start printing.
-    int startingline = get_starting_line_number(asciiNumber, nlines);
-    char buffer[2048];
-
-    if (startingline != -1) {
-      for (int i = 0; fgets(buffer, 2048, fp) != NULL; i++) {
-	if (i >= startingline) {
-	  printf("%d: %s", i, buffer);
-	}
-      }
+  load_history();
+
+  // Get the line to start printing.
+  int startingline = get_starting_line_number(asciiNumber, nentries);
+
+  if (startingline != -1) {
+    for (int i = startingline; i < nentries; i++) {
+      printf("%d: ", i);
+      fwrite(&history_text[offsets[i]], 1, offsets[i+1] - offsets[i], stdout);
     }
-    fclose(fp);
   }
 }
 
 
 void write_to_history(char **command) {
-  FILE *fp = fopen(get_history_path(), "a");
-  assert(fp != NULL);
+  if (!history_enabled) {
+    return;
+  }
+  load_history();
 
+  // join the words into a single line, don't add space after the
+  // word if it's the last word.
+  size_t len = 0;
   for (int i = 0; command[i] != NULL; i++) {
-    fputs(command[i], fp);
-    if (command[i+1] != NULL) {
-      // don't add space after the word if it's the last word.
-      fputc(' ', fp);
+    len += strlen(command[i]) + 1;
+  }
+  char *line = arena_alloc(&command_arena, len + 1);
+  char *end = line;
+  for (int i = 0; command[i] != NULL; i++) {
+    end = stpcpy(end, command[i]);
+    *end++ = (command[i+1] != NULL) ? ' ' : '\n';
+  }
+  if (end == line) {
+    *end++ = '\n';
+  }
+
+  append_entry(line, end - line - 1);
+  update_suggestions();
+
+  if (history_fp == NULL && get_history_path() != NULL) {
+    history_fp = fopen(get_history_path(), "ae");
+    if (history_fp != NULL) {
+      atexit(flush_history_at_exit);
+    }
+  }
+  if (history_fp != NULL) {
+    if (missing_newline) {
+      fputc('\n', history_fp);
+      missing_newline = false;
+    }
+    fwrite(line, 1, end - line, history_fp);
+  }
+}
+
+
+void search_history(char *pattern, bool prefix) {
+  char *history_path = get_history_path();
+  if (history_path == NULL) {
+    return;
+  }
+  // commands of this session must be in the file.
+  flush_history();
+
+  int fd = open(history_path, O_RDONLY);
+  if (fd == -1) {
+    return;
+  }
+
+  struct stat s;
+  if (fstat(fd, &s) == -1 || s.st_size == 0) {
+    close(fd);
+    return;
+  }
+
+  char *text = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED) {
+    perror("mmap");
+    return;
+  }
+
+  // split the file into chunks of whole lines, counting the lines
+  // before each chunk, then search the chunks from the last one so the
+  // newest matches come out first.
+  size_t size = s.st_size;
+  size_t max_chunks = size / SEARCH_CHUNK_SIZE + 2;
+  size_t *chunk_starts = malloc(sizeof(*chunk_starts) * max_chunks);
+  size_t *chunk_lines = malloc(sizeof(*chunk_lines) * max_chunks);
+
+  size_t nchunks = 0;
+  size_t lo = 0;
+  size_t nlines = 0;
+  while (lo < size) {
+    size_t hi = size;
+    if (size - lo > SEARCH_CHUNK_SIZE) {
+      char *newline = memchr(&text[lo + SEARCH_CHUNK_SIZE], '\n',
+                             size - lo - SEARCH_CHUNK_SIZE);
+      hi = (newline != NULL) ? (size_t)(newline - text) + 1 : size;
     }
+    chunk_starts[nchunks] = lo;
+    chunk_lines[nchunks] = nlines;
+    nchunks++;
+    nlines += count_newlines(&text[lo], hi - lo);
+    lo = hi;
+  }
+  chunk_starts[nchunks] = size;
+
+  for (size_t i = nchunks; i-- > 0;) {
+    search_chunk(text, chunk_starts[i], chunk_starts[i+1], chunk_lines[i],
+                 pattern, prefix);
+  }
+
+  free(chunk_starts);
+  free(chunk_lines);
+  munmap(text, s.st_size);
+}
+
+
+void flush_history() {
+  if (history_fp != NULL) {
+    fflush(history_fp);
   }
+}
 
-  fputc('\n', fp);
 
-  fclose(fp);
-  return;
+void disable_history() {
+  history_enabled = false;
 }
 
 
 int get_nlines() {
-  FILE *fp = fopen(get_history_path(), "r");
-  assert(fp != NULL);
+  load_history();
+  return nentries;
+}
+
 
-  int nlines = 0;
-  int ch;
-  while ((ch = fgetc(fp)) != EOF) {
-    if (ch == '\n') nlines++;
+char *get_history_entry(int n, int *len) {
+  load_history();
+  if (n < 0 || n >= nentries) {
+    return NULL;
   }
-  fclose(fp);
-  return nlines;
+  *len = offsets[n+1] - offsets[n];
+  return &history_text[offsets[n]];
 }
 
 
@@ -95,3 +238,233 @@ static int get_starting_line_number(char *asciiNumber, int nlines) {
   }
   return (startingline > 0) ? startingline: 0;
 }
+
+
+// Read the whole .cowrie_history file into memory and index the
+// start of every line, only done the first time history is used.
+static void load_history() {
+  if (history_loaded) {
+    return;
+  }
+  history_loaded = true;
+
+  text_size = INITIAL_TEXT_SIZE;
+  history_text = malloc(text_size);
+  offsets_size = INITIAL_NENTRIES;
+  offsets = malloc(sizeof(*offsets) * offsets_size);
+  offsets[0] = 0;
+
+  char *history_path = get_history_path();
+  int fd = (history_path != NULL) ? open(history_path, O_RDONLY) : -1;
+  if (fd == -1) {
+    return;
+  }
+
+  // read the file straight into the history text and index it there.
+  struct stat s;
+  if (fstat(fd, &s) == 0 && (size_t)s.st_size + 1 > text_size) {
+    text_size = s.st_size + 1;
+    history_text = realloc(history_text, text_size);
+  }
+  ssize_t n;
+  while ((n = read(fd, &history_text[text_len], text_size - text_len - 1)) > 0) {
+    text_len += n;
+    if (text_len + 1 == text_size) {
+      // the file grew since it was examined.
+      text_size *= 2;
+      history_text = realloc(history_text, text_size);
+    }
+  }
+  close(fd);
+
+  // the last line may not end with a newline, end it here and in the
+  // file before anything is appended to it.
+  if (text_len > 0 && history_text[text_len-1] != '\n') {
+    history_text[text_len++] = '\n';
+    missing_newline = true;
+  }
+
+  char *line = history_text;
+  char *end = history_text + text_len;
+  while (line < end) {
+    line = (char *)memchr(line, '\n', end - line) + 1;
+    if (nentries + 2 > offsets_size) {
+      offsets_size *= 2;
+      offsets = realloc(offsets, sizeof(*offsets) * offsets_size);
+    }
+    nentries++;
+    offsets[nentries] = line - history_text;
+  }
+}
+
+
+// Add a line of 'len' characters, not including its '\n', to the
+// in-memory history.
+static void append_entry(char *line, size_t len) {
+  if (text_len + len + 1 > text_size) {
+    while (text_len + len + 1 > text_size) {
+      text_size *= 2;
+    }
+    history_text = realloc(history_text, text_size);
+  }
+  memcpy(&history_text[text_len], line, len);
+  text_len += len;
+  history_text[text_len++] = '\n';
+
+  if (nentries + 2 > offsets_size) {
+    offsets_size *= 2;
+    offsets = realloc(offsets, sizeof(*offsets) * offsets_size);
+  }
+  nentries++;
+  offsets[nentries] = text_len;
+}
+
+
+static void flush_history_at_exit() {
+  flush_history();
+}
+
+
+// Returns the number of '\n' in the first 'len' characters of 's'.
+static size_t count_newlines(const char *s, size_t len) {
+  size_t count = 0;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  // compare 16 characters at a time, each lane counts its matches
+  // (a match is -1) until it could overflow, then the lanes are summed.
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+  while (i + 16 <= len) {
+    __m128i counts = zero;
+    for (int j = 0; j < 255 && i + 16 <= len; j++, i += 16) {
+      __m128i block = _mm_loadu_si128((const __m128i *)&s[i]);
+      counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(block, newline));
+    }
+    __m128i sums = _mm_sad_epu8(counts, zero);
+    count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+  }
+#endif
+
+  for (; i < len; i++) {
+    count += (s[i] == '\n');
+  }
+  return count;
+}
+
+
+// Returns the first occurrence of 'needle' in the first 'len' characters
+// of 's', or NULL if there's none.
+static char *find_substring(char *s, size_t len, char *needle, size_t needle_len) {
+  if (needle_len == 0) {
+    return s;
+  }
+  if (needle_len > len) {
+    return NULL;
+  }
+  if (needle_len == 1) {
+    return memchr(s, needle[0], len);
+  }
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  // find the positions of 16 candidates at a time whose first and last
+  // characters both match, only those are compared in full.
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len-1]);
+  for (; i + needle_len - 1 + 16 <= len; i += 16) {
+    __m128i block_first = _mm_loadu_si128((const __m128i *)&s[i]);
+    __m128i block_last = _mm_loadu_si128((const __m128i *)&s[i+needle_len-1]);
+    unsigned int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                      _mm_cmpeq_epi8(block_last, last)));
+    while (mask != 0) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(&s[i+bit+1], &needle[1], needle_len - 2) == 0) {
+        return &s[i+bit];
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  return memmem(&s[i], len - i, needle, needle_len);
+}
+
+
+// Print the lines in text[lo..hi) containing 'pattern', or starting
+// with it if 'prefix' is true, from the last one to the first one.
+// 'lo' is the start of a line numbered 'line_number'.
+static void search_chunk(char *text, size_t lo, size_t hi, size_t line_number,
+                         char *pattern, bool prefix) {
+  size_t pattern_len = strlen(pattern);
+
+  // a prefix is found by searching for a newline followed by it.
+  char needle[pattern_len + 2];
+  needle[0] = '\n';
+  strcpy(&needle[1], pattern);
+  char *key = prefix ? needle : pattern;
+  size_t key_len = prefix ? pattern_len + 1 : pattern_len;
+
+  size_t nmatches = 0;
+  size_t size = 16;
+  size_t *starts = malloc(sizeof(*starts) * size);
+  size_t *numbers = malloc(sizeof(*numbers) * size);
+
+  char *end = &text[hi];
+  char *counted = &text[lo];
+  char *line = &text[lo];
+  while (line < end) {
+    char *start;
+    if (prefix && line == &text[lo]) {
+      // the first line has no newline before it in the chunk.
+      start = (hi - lo >= pattern_len &&
+               memcmp(line, pattern, pattern_len) == 0) ? line : NULL;
+      if (start == NULL) {
+        start = find_substring(line, end - line, key, key_len);
+        if (start != NULL) start++;
+      }
+    } else if (prefix) {
+      start = find_substring(line - 1, end - line + 1, key, key_len);
+      if (start != NULL) start++;
+    } else {
+      char *match = find_substring(line, end - line, key, key_len);
+      start = NULL;
+      if (match != NULL) {
+        start = memrchr(line, '\n', match - line);
+        start = (start != NULL) ? start + 1 : line;
+      }
+    }
+
+    if (start == NULL || start >= end) {
+      break;
+    }
+
+    line_number += count_newlines(counted, start - counted);
+    counted = start;
+    if (nmatches == size) {
+      size *= 2;
+      starts = realloc(starts, sizeof(*starts) * size);
+      numbers = realloc(numbers, sizeof(*numbers) * size);
+    }
+    starts[nmatches] = start - text;
+    numbers[nmatches] = line_number;
+    nmatches++;
+
+    char *newline = memchr(start, '\n', end - start);
+    line = (newline != NULL) ? newline + 1 : end;
+  }
+
+  for (size_t i = nmatches; i-- > 0;) {
+    char *start = &text[starts[i]];
+    char *newline = memchr(start, '\n', end - start);
+    size_t len = (newline != NULL) ? newline - start : end - start;
+    printf("%zu: ", numbers[i]);
+    fwrite(start, 1, len, stdout);
+    putchar('\n');
+  }
+
+  free(starts);
+  free(numbers);
+}
@@ -1,4 +1,6 @@
-// Get the absolute path to the .cowrie_history file.
+#include <stdbool.h>
+// Get the absolute path to the .cowrie_history file, returns NULL
+// if HOME isn't set.
 char *get_history_path();
 
 
@@ -6,9 +8,29 @@ char *get_history_path();
 void print_history(char *asciiNumber);
 
 
+// Prints the lines in history containing 'pattern', or starting with
+// it if 'prefix' is true, the newest first.
+void search_history(char *pattern, bool prefix);
+
+
 // Append the command line to the .cowrie_history file.
 void write_to_history(char **command);
 
 
 // Returns number of lines in .cowrie_history file.
 int get_nlines();
+
+
+// Returns the n-th line of the history, which is not NUL-terminated
+// and ends with '\n', and saves its length into 'len'. Returns NULL if
+// there's no such line.
+char *get_history_entry(int n, int *len);
+
+
+// Write the commands appended since the last flush to the
+// .cowrie_history file.
+void flush_history();
+
+
+// Stop appending commands to the .cowrie_history file.
+void disable_history();
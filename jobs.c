@@ -0,0 +1,686 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "helper.h"
+#include "simsh.h"
+#include "jobs.h"
+
+
+// the shell controls jobs, it's interactive on a terminal.
+static bool job_control = false;
+static bool interactive_shell = false;
+static int terminal = -1;
+static pid_t shell_pgid;
+// the terminal modes of the shell, restored when a job stops.
+static struct termios shell_modes;
+
+// set by the SIGCHLD handler, a child changed state since the last time
+// children were reaped.
+static volatile sig_atomic_t child_changed = 0;
+
+// the job being waited for in the foreground, not in the table.
+static struct job *foreground_job = NULL;
+
+// the job table, in increasing order of ids. The last job is the
+// current one, '%+', and the one before it the previous one, '%-'.
+static struct job **jobs = NULL;
+static int njobs = 0;
+static int jobs_size = 0;
+
+
+static void handle_sigchld(int sig);
+static void reap_children();
+static void wait_for_changes(struct job *job);
+static bool job_is_completed(struct job *job);
+static bool job_is_stopped(struct job *job);
+static void continue_job(struct job *job);
+static void add_to_table(struct job *job);
+static void remove_from_table(struct job *job);
+static void free_job(struct job *job);
+static struct job *find_job(char *builtin, char *spec);
+static void print_job(struct job *job, int index, bool show_pids);
+static void print_state(struct job *job, char *state, size_t size);
+
+
+void init_jobs(bool interactive) {
+  interactive_shell = interactive;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_sigchld;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGCHLD, &action, NULL);
+
+  if (!interactive || !isatty(STDIN_FILENO)) {
+    return;
+  }
+  terminal = STDIN_FILENO;
+
+  // wait until the shell is started in the foreground.
+  while (tcgetpgrp(terminal) != (shell_pgid = getpgrp())) {
+    kill(-shell_pgid, SIGTTIN);
+  }
+
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+
+  shell_pgid = getpid();
+  if (getpgrp() != shell_pgid && setpgid(shell_pgid, shell_pgid) == -1) {
+    perror("setpgid");
+    return;
+  }
+  tcsetpgrp(terminal, shell_pgid);
+  tcgetattr(terminal, &shell_modes);
+  job_control = true;
+}
+
+
+struct job *create_job(struct stage *stages, int nstages) {
+  struct job *job = calloc(1, sizeof(*job));
+  job->processes = calloc(nstages, sizeof(*job->processes));
+
+  // the pipeline as it was typed, its words and redirections.
+  static char *operators[] = {
+    [REDIRECT_INPUT] = "<", [REDIRECT_OUTPUT] = ">", [REDIRECT_APPEND] = ">>",
+    [REDIRECT_READ_WRITE] = "<>", [REDIRECT_DUPLICATE] = ">&",
+    [REDIRECT_CLOSE] = ">&", [REDIRECT_HERE_DOCUMENT] = "<<",
+    [REDIRECT_HERE_DOCUMENT_INDENTED] = "<<-", [REDIRECT_HERE_STRING] = "<<<",
+  };
+  size_t size = 1;
+  for (int i = 0; i < nstages; i++) {
+    for (int j = 0; j < stages[i].argc; j++) {
+      size += strlen(stages[i].argv[j]) + 1;
+    }
+    for (int j = 0; j < stages[i].nredirections; j++) {
+      size += strlen(stages[i].redirections[j].target) + 16;
+    }
+    size += 3;
+  }
+
+  job->command = malloc(size);
+  char *end = job->command;
+  *end = '\0';
+  for (int i = 0; i < nstages; i++) {
+    if (i > 0) {
+      end = stpcpy(end, " | ");
+    }
+    for (int j = 0; j < stages[i].argc; j++) {
+      end = stpcpy(end, (j > 0) ? " " : "");
+      end = stpcpy(end, stages[i].argv[j]);
+    }
+    for (int j = 0; j < stages[i].nredirections; j++) {
+      // the descriptor is left out where the operator implies it.
+      struct redirection *redirection = &stages[i].redirections[j];
+      enum redirection_type type = redirection->type;
+      int implied_fd = (type == REDIRECT_INPUT || type == REDIRECT_READ_WRITE ||
+                        redirection->body != NULL) ? 0 : 1;
+      bool copy = (type == REDIRECT_DUPLICATE || type == REDIRECT_CLOSE);
+      end += sprintf(end, " ");
+      if (redirection->fd != implied_fd) {
+        end += sprintf(end, "%d", redirection->fd);
+      }
+      end += sprintf(end, "%s%s%s", operators[type], copy ? "" : " ",
+                     redirection->target);
+    }
+  }
+  return job;
+}
+
+
+struct spawn_group *get_spawn_group(struct job *job, bool foreground,
+                                    struct spawn_group *group) {
+  if (!job_control) {
+    return NULL;
+  }
+  group->pgid = job->pgid;
+  group->terminal = foreground ? terminal : -1;
+  return group;
+}
+
+
+void add_process(struct job *job, pid_t pid, char *path, int status) {
+  struct process *process = &job->processes[job->nprocesses++];
+  process->pid = pid;
+  process->path = strdup(path != NULL ? path : "");
+  process->status = 0;
+  process->stopped = false;
+  process->completed = false;
+  memset(&process->usage, 0, sizeof(process->usage));
+  process->usage.started = metrics_clock();
+
+  if (pid == -1) {
+    process->status = W_EXITCODE(status, 0);
+    process->completed = true;
+    process->usage.finished = process->usage.started;
+  } else if (job->pgid == 0 && job_control) {
+    // the first program spawned leads the group.
+    job->pgid = pid;
+  }
+}
+
+
+int wait_for_job(struct job *job, int *statuses) {
+  take_phase_times(job->phases);
+  foreground_job = job;
+  if (job_control && job->pgid != 0) {
+    tcsetpgrp(terminal, job->pgid);
+  }
+
+  wait_for_changes(job);
+
+  foreground_job = NULL;
+  if (job_control) {
+    tcsetpgrp(terminal, shell_pgid);
+    tcsetattr(terminal, TCSADRAIN, &shell_modes);
+  }
+
+  int own_statuses[job->nprocesses];
+  if (statuses == NULL) {
+    statuses = own_statuses;
+  }
+  // the programs of a stopped job are reported once all of them finish.
+  bool completed = job_is_completed(job);
+  for (int i = 0; i < job->nprocesses; i++) {
+    struct process *process = &job->processes[i];
+    if (process->pid == -1) {
+      statuses[i] = WEXITSTATUS(process->status);
+    } else if (!process->completed) {
+      statuses[i] = 128 + WSTOPSIG(process->status);
+    } else if (!completed) {
+      statuses[i] = WIFEXITED(process->status) ?
+                    WEXITSTATUS(process->status) :
+                    128 + WTERMSIG(process->status);
+    } else {
+      statuses[i] = report_exit_status(process->path, process->status);
+    }
+  }
+  int status = statuses[job->nprocesses - 1];
+
+  // the prompt goes on a line of its own after a job killed from the
+  // keyboard, other signals are named.
+  struct process *last = &job->processes[job->nprocesses - 1];
+  if (job_control && last->completed && WIFSIGNALED(last->status)) {
+    int sig = WTERMSIG(last->status);
+    if (sig != SIGINT && sig != SIGPIPE) {
+      printf("%s%s", strsignal(sig),
+             WCOREDUMP(last->status) ? " (core dumped)" : "");
+    }
+    printf("\n");
+  }
+
+  if (!completed) {
+    // stopped from the keyboard, it's kept until it's continued.
+    if (job->id == 0) {
+      add_to_table(job);
+    }
+    job->notified = true;
+    printf("\n");
+    print_job(job, njobs - 1, false);
+    return status;
+  }
+
+  if (job->id != 0) {
+    remove_from_table(job);
+  }
+  free_job(job);
+  return status;
+}
+
+
+void put_job_in_background(struct job *job) {
+  take_phase_times(job->phases);
+  add_to_table(job);
+  if (interactive_shell) {
+    printf("[%d] %d\n", job->id, job->processes[job->nprocesses - 1].pid);
+  }
+}
+
+
+void notify_jobs() {
+  reap_children();
+
+  for (int i = 0; i < njobs; i++) {
+    struct job *job = jobs[i];
+    if (job_is_completed(job)) {
+      // a script keeps finished jobs until it waits for them, so their
+      // status is still there for 'wait %n'.
+      if (interactive_shell) {
+        print_job(job, i, false);
+        remove_from_table(job);
+        free_job(job);
+        i--;
+      }
+    } else if (job_is_stopped(job) && !job->notified) {
+      if (interactive_shell) {
+        print_job(job, i, false);
+      }
+      job->notified = true;
+    }
+  }
+  fflush(stdout);
+}
+
+
+bool update_job_status(pid_t pid, int status, struct rusage *rusage) {
+  for (int i = -1; i < njobs; i++) {
+    struct job *job = (i == -1) ? foreground_job : jobs[i];
+    if (job == NULL) {
+      continue;
+    }
+
+    for (int j = 0; j < job->nprocesses; j++) {
+      struct process *process = &job->processes[j];
+      if (process->pid != pid) {
+        continue;
+      }
+
+      if (WIFCONTINUED(status)) {
+        process->stopped = false;
+      } else {
+        process->status = status;
+        process->stopped = WIFSTOPPED(status);
+        process->completed = !process->stopped;
+      }
+      if (process->completed) {
+        process->usage.finished = metrics_clock();
+        process->usage.rusage = *rusage;
+      }
+      job->notified = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+//
+// Implement the 'jobs' shell built-in, which lists the jobs in the
+// table. Finished jobs are listed once and forgotten.
+//
+// Synopsis: jobs [-l|-p] [job...]
+// Examples:
+//     % jobs
+//     % jobs -l %1
+//
+int do_jobs(char **words) {
+  bool show_pids = false;
+  bool only_pids = false;
+  int i = 1;
+  for (; words[i] != NULL && words[i][0] == '-'; i++) {
+    if (strcmp(words[i], "-l") == 0) {
+      show_pids = true;
+    } else if (strcmp(words[i], "-p") == 0) {
+      only_pids = true;
+    } else {
+      fprintf(stderr, "jobs: %s: invalid option\n", words[i]);
+      return 2;
+    }
+  }
+
+  reap_children();
+
+  int status = 0;
+  bool listed[njobs + 1];
+  memset(listed, 0, sizeof(listed));
+  for (int j = 0; j < njobs; j++) {
+    listed[j] = (words[i] == NULL);
+  }
+  for (; words[i] != NULL; i++) {
+    struct job *job = find_job("jobs", words[i]);
+    for (int j = 0; j < njobs; j++) {
+      listed[j] |= (jobs[j] == job);
+    }
+    status |= (job == NULL);
+  }
+
+  for (int j = 0; j < njobs; j++) {
+    if (!listed[j]) {
+      continue;
+    }
+    if (only_pids) {
+      printf("%d\n", jobs[j]->processes[0].pid);
+    } else {
+      print_job(jobs[j], j, show_pids);
+    }
+    jobs[j]->notified = true;
+  }
+
+  // the finished jobs were reported.
+  for (int j = 0; j < njobs; j++) {
+    if (listed[j] && job_is_completed(jobs[j])) {
+      struct job *job = jobs[j];
+      remove_from_table(job);
+      free_job(job);
+      memmove(&listed[j], &listed[j+1], sizeof(bool) * (njobs - j));
+      j--;
+    }
+  }
+  return status;
+}
+
+
+//
+// Implement the 'fg' shell built-in, which continues a job in the
+// foreground and waits for it.
+//
+// Synopsis: fg [job]
+// Examples:
+//     % fg
+//     % fg %2
+//
+int do_fg(char **words) {
+  if (!job_control) {
+    fprintf(stderr, "fg: no job control\n");
+    return 1;
+  }
+
+  struct job *job = find_job("fg", words[1]);
+  if (job == NULL) {
+    return 1;
+  }
+
+  printf("%s\n", job->command);
+  fflush(stdout);
+  tcsetpgrp(terminal, job->pgid);
+  continue_job(job);
+  return wait_for_job(job, NULL);
+}
+
+
+//
+// Implement the 'bg' shell built-in, which continues a stopped job in
+// the background.
+//
+// Synopsis: bg [job...]
+// Examples:
+//     % bg
+//     % bg %1 %2
+//
+int do_bg(char **words) {
+  if (!job_control) {
+    fprintf(stderr, "bg: no job control\n");
+    return 1;
+  }
+
+  // without arguments, the current job is continued.
+  int status = 0;
+  int nspecs = count_nwords(words) - 1;
+  for (int i = 1; i <= nspecs || i == 1; i++) {
+    struct job *job = find_job("bg", words[i]);
+    if (job == NULL) {
+      status = 1;
+      continue;
+    }
+    continue_job(job);
+    printf("[%d] %s &\n", job->id, job->command);
+  }
+  return status;
+}
+
+
+//
+// Implement the 'wait' shell built-in, which waits for jobs, or every
+// job, to finish and forgets them.
+//
+// Synopsis: wait [job|pid...]
+// Examples:
+//     % wait
+//     % wait %1 4242
+//
+int do_wait(char **words) {
+  int status = 0;
+
+  if (words[1] == NULL) {
+    while (njobs > 0) {
+      struct job *job = jobs[0];
+      wait_for_changes(job);
+      if (!job_is_completed(job)) {
+        // a stopped job won't finish, stop waiting for it.
+        break;
+      }
+      remove_from_table(job);
+      free_job(job);
+    }
+    return 0;
+  }
+
+  for (int i = 1; words[i] != NULL; i++) {
+    struct job *job = NULL;
+    if (words[i][0] == '%') {
+      job = find_job("wait", words[i]);
+    } else if (is_integer(words[i])) {
+      pid_t pid = atoi(words[i]);
+      for (int j = 0; j < njobs && job == NULL; j++) {
+        for (int k = 0; k < jobs[j]->nprocesses; k++) {
+          if (jobs[j]->processes[k].pid == pid) {
+            job = jobs[j];
+          }
+        }
+      }
+      if (job == NULL) {
+        fprintf(stderr, "wait: pid %s is not a child of this shell\n",
+                words[i]);
+      }
+    } else {
+      fprintf(stderr, "wait: %s: not a pid or valid job spec\n", words[i]);
+    }
+
+    if (job == NULL) {
+      status = 127;
+      continue;
+    }
+
+    wait_for_changes(job);
+    struct process *last = &job->processes[job->nprocesses - 1];
+    if (!job_is_completed(job)) {
+      status = 128 + WSTOPSIG(last->status);
+      continue;
+    }
+    status = WIFEXITED(last->status) ? WEXITSTATUS(last->status)
+                                     : 128 + WTERMSIG(last->status);
+    remove_from_table(job);
+    free_job(job);
+  }
+  return status;
+}
+
+
+static void handle_sigchld(int sig) {
+  (void) sig;
+  child_changed = 1;
+}
+
+
+// Reap the children which changed state, if SIGCHLD said there are any.
+static void reap_children() {
+  if (!child_changed) {
+    return;
+  }
+  child_changed = 0;
+
+  int status;
+  struct rusage rusage;
+  pid_t pid;
+  while ((pid = wait4(-1, &status, WNOHANG|WUNTRACED|WCONTINUED, &rusage)) > 0) {
+    update_job_status(pid, status, &rusage);
+  }
+}
+
+
+// Wait until every program of 'job' has finished, or until it's stopped.
+static void wait_for_changes(struct job *job) {
+  while (!job_is_completed(job) && !job_is_stopped(job)) {
+    int status;
+    struct rusage rusage;
+    pid_t pid = wait4(-1, &status, WUNTRACED, &rusage);
+    if (pid == -1 && errno == EINTR) {
+      continue;
+    }
+    if (pid == -1) {
+      // the programs left were reaped by someone else.
+      for (int i = 0; i < job->nprocesses; i++) {
+        if (!job->processes[i].completed) {
+          job->processes[i].completed = true;
+          job->processes[i].usage.finished = metrics_clock();
+        }
+      }
+      break;
+    }
+    update_job_status(pid, status, &rusage);
+  }
+}
+
+
+static bool job_is_completed(struct job *job) {
+  for (int i = 0; i < job->nprocesses; i++) {
+    if (!job->processes[i].completed) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Returns true if every program of 'job' has finished or is stopped.
+static bool job_is_stopped(struct job *job) {
+  for (int i = 0; i < job->nprocesses; i++) {
+    if (!job->processes[i].completed && !job->processes[i].stopped) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Send SIGCONT to the group of a stopped job.
+static void continue_job(struct job *job) {
+  for (int i = 0; i < job->nprocesses; i++) {
+    job->processes[i].stopped = false;
+  }
+  job->notified = false;
+  if (kill(-job->pgid, SIGCONT) == -1) {
+    perror("kill (SIGCONT)");
+  }
+}
+
+
+static void add_to_table(struct job *job) {
+  if (njobs == jobs_size) {
+    jobs_size = (jobs_size > 0) ? jobs_size * 2 : 8;
+    jobs = realloc(jobs, sizeof(*jobs) * jobs_size);
+  }
+  job->id = (njobs > 0) ? jobs[njobs - 1]->id + 1 : 1;
+  jobs[njobs++] = job;
+}
+
+
+static void remove_from_table(struct job *job) {
+  for (int i = 0; i < njobs; i++) {
+    if (jobs[i] == job) {
+      memmove(&jobs[i], &jobs[i+1], sizeof(*jobs) * (njobs - i - 1));
+      njobs--;
+      return;
+    }
+  }
+}
+
+
+static void free_job(struct job *job) {
+  if (job_is_completed(job)) {
+    record_metrics(job->command, job->processes, job->nprocesses, job->phases);
+  }
+  for (int i = 0; i < job->nprocesses; i++) {
+    free(job->processes[i].path);
+  }
+  free(job->processes);
+  free(job->command);
+  free(job);
+}
+
+
+// Returns the job 'spec' refers to, the current job if it's NULL, or
+// prints a message and returns NULL if there's no such job.
+// A job is referred to by '%n' or 'n', '%+' or '%%' for the current
+// job, '%-' for the previous one, or '%name' for the job whose command
+// starts with 'name'.
+static struct job *find_job(char *builtin, char *spec) {
+  struct job *job = NULL;
+  char *name = (spec != NULL && spec[0] == '%') ? spec + 1 : spec;
+
+  if (name == NULL || strcmp(name, "") == 0 || strcmp(name, "%") == 0 ||
+      strcmp(name, "+") == 0) {
+    job = (njobs > 0) ? jobs[njobs - 1] : NULL;
+  } else if (strcmp(name, "-") == 0) {
+    job = (njobs > 1) ? jobs[njobs - 2] : NULL;
+  } else if (is_integer(name)) {
+    for (int i = 0; i < njobs; i++) {
+      if (jobs[i]->id == atoi(name)) {
+        job = jobs[i];
+      }
+    }
+  } else {
+    for (int i = njobs - 1; i >= 0 && job == NULL; i--) {
+      if (startsWith(name, jobs[i]->command)) {
+        job = jobs[i];
+      }
+    }
+  }
+
+  if (job == NULL) {
+    fprintf(stderr, "%s: %s: no such job\n", builtin,
+            (spec != NULL) ? spec : "current");
+  }
+  return job;
+}
+
+
+// Prints a line of 'jobs' for the job at 'index' of the table.
+static void print_job(struct job *job, int index, bool show_pids) {
+  char marker = ' ';
+  if (index == njobs - 1) {
+    marker = '+';
+  } else if (index == njobs - 2) {
+    marker = '-';
+  }
+
+  char state[64];
+  print_state(job, state, sizeof(state));
+  bool running = !job_is_completed(job) && !job_is_stopped(job);
+
+  printf("[%d]%c  ", job->id, marker);
+  if (show_pids) {
+    printf("%d ", job->pgid != 0 ? job->pgid : job->processes[0].pid);
+  }
+  printf("%-24s%s%s\n", state, job->command, running ? " &" : "");
+}
+
+
+// Save how 'job' is doing into 'state', as 'jobs' shows it.
+static void print_state(struct job *job, char *state, size_t size) {
+  struct process *last = &job->processes[job->nprocesses - 1];
+
+  if (!job_is_completed(job)) {
+    snprintf(state, size, "%s", job_is_stopped(job) ? "Stopped" : "Running");
+  } else if (WIFSIGNALED(last->status)) {
+    snprintf(state, size, "%s", strsignal(WTERMSIG(last->status)));
+  } else if (WEXITSTATUS(last->status) != 0) {
+    snprintf(state, size, "Exit %d", WEXITSTATUS(last->status));
+  } else {
+    snprintf(state, size, "Done");
+  }
+}
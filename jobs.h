@@ -0,0 +1,97 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "parser.h"
+#include "execcache.h"
+#include "metrics.h"
+
+// A program of a job.
+struct process {
+  pid_t pid;
+  // the path it was run by, for reporting its exit status.
+  char *path;
+  // as returned by 'waitpid'.
+  int status;
+  bool completed;
+  bool stopped;
+  // what it used, once it's completed.
+  struct process_usage usage;
+};
+
+
+// The programs spawned for a pipeline, which share a process group
+// when the shell controls jobs.
+struct job {
+  // the number it's referred to by as '%id', 0 until it's in the table.
+  int id;
+  pid_t pgid;
+  // the pipeline as it was typed, for 'jobs'.
+  char *command;
+  struct process *processes;
+  int nprocesses;
+  // its state was printed since it last changed.
+  bool notified;
+  // the time the shell spent running it, by phase.
+  uint64_t phases[NPHASES];
+};
+
+
+// Set up job control if the shell is interactive on a terminal: put the
+// shell in a process group of its own in the foreground, and ignore the
+// signals sent from the keyboard and for stopped background groups.
+// Children are reaped once SIGCHLD says one changed state.
+void init_jobs(bool interactive);
+
+
+// Returns a new job for the programs of 'nstages' stages, none has
+// been spawned yet.
+struct job *create_job(struct stage *stages, int nstages);
+
+
+// Save into 'group' the process group the next program of 'job' is
+// spawned in, returns NULL if the shell doesn't control jobs.
+struct spawn_group *get_spawn_group(struct job *job, bool foreground,
+                                    struct spawn_group *group);
+
+
+// Add a spawned program to 'job', 'pid' is -1 if it couldn't be spawned
+// and 'status' is then its exit status.
+void add_process(struct job *job, pid_t pid, char *path, int status);
+
+
+// Give the terminal to 'job' and wait until all of its programs finish,
+// or until it's stopped and it's moved to the job table. The exit status
+// of every program is saved into 'statuses'.
+// Returns the exit status of the last program.
+int wait_for_job(struct job *job, int *statuses);
+
+
+// Add 'job' to the job table without waiting for it.
+void put_job_in_background(struct job *job);
+
+
+// Reap the programs which changed state. An interactive shell then
+// prints the jobs which finished or were stopped since the last call
+// and forgets the finished ones; a script keeps them until it waits for
+// them. Call this before reading every line.
+void notify_jobs();
+
+
+// Save the status of the program 'pid' and what it used, as returned by
+// 'wait4', into the job it belongs to. Returns false if it's not a
+// program of a job. Call this for a child reaped outside of the job
+// table.
+bool update_job_status(pid_t pid, int status, struct rusage *rusage);
+
+
+// Implement the 'jobs', 'fg', 'bg' and 'wait' shell built-ins, returns
+// the exit status.
+int do_jobs(char **words);
+int do_fg(char **words);
+int do_bg(char **words);
+int do_wait(char **words);
+
+#endif
@@ -0,0 +1,853 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "history.h"
+#include "complete.h"
+#include "suggest.h"
+#include "lineedit.h"
+
+#define CONTROL(c) ((c) & 0x1f)
+#define ESCAPE 0x1b
+#define BACKSPACE 0x7f
+
+// the width assumed when the terminal doesn't tell, and the widest
+// terminal the screen is modelled for.
+#define DEFAULT_COLUMNS 80
+#define MAX_COLUMNS 1024
+
+// the longest escape sequence of a key read.
+#define MAX_SEQUENCE 16
+
+// what's written for a key is collected here and written at once.
+#define OUTPUT_SIZE 8192
+
+// marks a cell of the screen shown dimmed, as a suggestion.
+#define DIM_CELL ((uint64_t)1 << 32)
+
+// keys which aren't a single byte.
+enum {
+  KEY_UP = 256,
+  KEY_DOWN,
+  KEY_LEFT,
+  KEY_RIGHT,
+  KEY_WORD_LEFT,
+  KEY_WORD_RIGHT,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE,
+  KEY_UNKNOWN,
+  KEY_RESIZE,
+  // a byte typed with Alt, or after Escape.
+  KEY_META = 512,
+};
+
+// The line being edited, and what's shown of it on the screen.
+struct editor {
+  char *prompt;
+  // the caller's buffer, the line isn't NUL-terminated until it's read.
+  char **line;
+  size_t *size;
+  size_t len;
+  // byte offsets of the cursor and of the first character shown.
+  size_t cursor;
+  size_t first;
+  // the column the line starts at after the prompt, and the number of
+  // columns it's shown in.
+  int start;
+  int width;
+  // the characters on the screen after the prompt, each the bytes of a
+  // UTF-8 character packed in order from the lowest, and the column of
+  // the cursor among them.
+  uint64_t shown[MAX_COLUMNS];
+  int nshown;
+  int column;
+  // the history entry shown, -1 while it's the line being typed, which
+  // is saved while entries are shown.
+  int history_index;
+  char *saved;
+  size_t saved_len;
+  // the history entry which starts with the line is suggested after it.
+  bool suggesting;
+};
+
+
+static ssize_t edit(struct editor *e);
+static void handle_sigwinch(int sig);
+static bool is_dumb_terminal();
+static int read_byte(bool interruptible);
+static int read_key();
+static int read_sequence(int introducer);
+static bool input_pending();
+static void measure(struct editor *e);
+static int get_prompt_width(char *prompt);
+static void redraw(struct editor *e);
+static void refresh(struct editor *e);
+static void move_cursor(struct editor *e, int column);
+static void emit(const char *s, size_t n);
+static uint64_t pack_cell(const char *s, size_t n);
+static void emit_cells(const uint64_t *cells, int n);
+static void flush_output();
+static size_t next_char(struct editor *e, size_t i);
+static size_t previous_char(struct editor *e, size_t i);
+static size_t next_word(struct editor *e, size_t i);
+static size_t previous_word(struct editor *e, size_t i);
+static int count_cells(struct editor *e, size_t from, size_t to, int limit);
+static void reserve(struct editor *e, size_t len);
+static void insert(struct editor *e, const char *s, size_t n);
+static void delete(struct editor *e, size_t from, size_t to);
+static void kill_text(struct editor *e, size_t from, size_t to);
+static void set_line(struct editor *e, const char *s, size_t n);
+static void recall(struct editor *e, int direction);
+static void complete_word(struct editor *e, bool list);
+static void list_matches(struct editor *e, struct completion *completion);
+static bool accept_suggestion(struct editor *e);
+
+// the editor is too big for the stack, there's only ever one line edited.
+static struct editor editor;
+
+// the text killed last, for Ctrl-Y.
+static char *killed;
+static size_t killed_len;
+
+static char output[OUTPUT_SIZE];
+static size_t output_len;
+
+static volatile sig_atomic_t resized = 0;
+
+
+ssize_t edit_line(char *prompt, char **line, size_t *size) {
+  struct termios modes;
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || is_dumb_terminal() ||
+      tcgetattr(STDIN_FILENO, &modes) == -1) {
+    fputs(prompt, stdout);
+    fflush(stdout);
+    return getline(line, size, stdin);
+  }
+  fflush(stdout);
+
+  // keys are read one byte at a time as they're typed, and anything
+  // typed ahead is left for what runs the line.
+  struct termios raw = modes;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_cflag |= CS8;
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1) {
+    fputs(prompt, stdout);
+    fflush(stdout);
+    return getline(line, size, stdin);
+  }
+
+  // a resize interrupts the read of a key to redraw the line.
+  struct sigaction action, old_action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_sigwinch;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGWINCH, &action, &old_action);
+
+  editor.prompt = prompt;
+  editor.line = line;
+  editor.size = size;
+  ssize_t len = edit(&editor);
+
+  sigaction(SIGWINCH, &old_action, NULL);
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &modes);
+  return len;
+}
+
+
+// Read keys and edit the line until it's entered.
+static ssize_t edit(struct editor *e) {
+  reserve(e, 0);
+  e->len = 0;
+  e->cursor = 0;
+  e->first = 0;
+  e->history_index = -1;
+  e->suggesting = true;
+  measure(e);
+  emit(e->prompt, strlen(e->prompt));
+  e->nshown = 0;
+  e->column = 0;
+
+  int last_key = 0;
+  for (;;) {
+    // keys typed ahead or pasted are all taken before the line is
+    // drawn again.
+    if (!input_pending()) {
+      refresh(e);
+    }
+    flush_output();
+
+    int key = read_key();
+    switch (key) {
+    case '\t':
+      complete_word(e, last_key == '\t');
+      break;
+    case -1:
+      emit("\n", 1);
+      flush_output();
+      return -1;
+    case '\r':
+    case '\n':
+      e->cursor = e->len;
+      e->suggesting = false;
+      refresh(e);
+      emit("\n", 1);
+      flush_output();
+      reserve(e, e->len + 2);
+      (*e->line)[e->len] = '\n';
+      (*e->line)[e->len + 1] = '\0';
+      return e->len + 1;
+    case CONTROL('A'):
+    case KEY_HOME:
+      e->cursor = 0;
+      break;
+    case CONTROL('E'):
+    case KEY_END:
+      // at the end of the line, the suggestion is taken.
+      if (e->cursor == e->len) {
+        accept_suggestion(e);
+      }
+      e->cursor = e->len;
+      break;
+    case CONTROL('B'):
+    case KEY_LEFT:
+      e->cursor = previous_char(e, e->cursor);
+      break;
+    case CONTROL('F'):
+    case KEY_RIGHT:
+      if (e->cursor < e->len || !accept_suggestion(e)) {
+        e->cursor = next_char(e, e->cursor);
+      }
+      break;
+    case KEY_META | 'b':
+    case KEY_WORD_LEFT:
+      e->cursor = previous_word(e, e->cursor);
+      break;
+    case KEY_META | 'f':
+    case KEY_WORD_RIGHT:
+      e->cursor = next_word(e, e->cursor);
+      break;
+    case CONTROL('H'):
+    case BACKSPACE:
+      delete(e, previous_char(e, e->cursor), e->cursor);
+      break;
+    case CONTROL('D'):
+      if (e->len == 0) {
+        emit("\n", 1);
+        flush_output();
+        return -1;
+      }
+      delete(e, e->cursor, next_char(e, e->cursor));
+      break;
+    case KEY_DELETE:
+      delete(e, e->cursor, next_char(e, e->cursor));
+      break;
+    case CONTROL('W'):
+    case KEY_META | BACKSPACE:
+      kill_text(e, previous_word(e, e->cursor), e->cursor);
+      break;
+    case KEY_META | 'd':
+      kill_text(e, e->cursor, next_word(e, e->cursor));
+      break;
+    case CONTROL('U'):
+      kill_text(e, 0, e->cursor);
+      break;
+    case CONTROL('K'):
+      kill_text(e, e->cursor, e->len);
+      break;
+    case CONTROL('Y'):
+      if (killed_len > 0) {
+        insert(e, killed, killed_len);
+      }
+      break;
+    case CONTROL('P'):
+    case KEY_UP:
+      recall(e, -1);
+      break;
+    case CONTROL('N'):
+    case KEY_DOWN:
+      recall(e, 1);
+      break;
+    case CONTROL('L'):
+      emit("\033[H\033[2J", 7);
+      redraw(e);
+      break;
+    case CONTROL('C'):
+      emit("^C\n", 3);
+      e->len = 0;
+      e->cursor = 0;
+      e->first = 0;
+      e->history_index = -1;
+      redraw(e);
+      break;
+    case KEY_RESIZE:
+      measure(e);
+      redraw(e);
+      break;
+    default:
+      // other control characters and unknown keys are ignored.
+      if (key >= ' ' && key < 256 && key != BACKSPACE) {
+        char c = key;
+        insert(e, &c, 1);
+      }
+      break;
+    }
+    last_key = key;
+  }
+}
+
+
+static void handle_sigwinch(int sig) {
+  (void) sig;
+  resized = 1;
+}
+
+
+static bool is_dumb_terminal() {
+  char *term = getenv("TERM");
+  return term == NULL || strcmp(term, "dumb") == 0;
+}
+
+
+// Returns the next byte typed, KEY_RESIZE if the terminal was resized
+// while waiting for it and 'interruptible' is true, or -1 at the end of
+// input.
+static int read_byte(bool interruptible) {
+  unsigned char c;
+  for (;;) {
+    ssize_t n = read(STDIN_FILENO, &c, 1);
+    if (n == 1) {
+      return c;
+    }
+    if (n == -1 && errno == EINTR) {
+      if (resized && interruptible) {
+        resized = 0;
+        return KEY_RESIZE;
+      }
+      continue;
+    }
+    return -1;
+  }
+}
+
+
+// Returns the next key typed, a byte or one of the keys above.
+static int read_key() {
+  int c = read_byte(true);
+  if (c != ESCAPE) {
+    return c;
+  }
+  int next = read_byte(false);
+  if (next == '[' || next == 'O') {
+    return read_sequence(next);
+  }
+  return (next == -1) ? -1 : KEY_META | next;
+}
+
+
+// Read the rest of the escape sequence of a key, after 'ESC [' or
+// 'ESC O', and returns the key.
+static int read_sequence(int introducer) {
+  char parameters[MAX_SEQUENCE];
+  int nparameters = 0;
+  int c;
+  // the parameters end with a byte in '@' to '~'.
+  while ((c = read_byte(false)) != -1 && (c < '@' || c > '~')) {
+    if (nparameters < MAX_SEQUENCE - 1) {
+      parameters[nparameters++] = c;
+    }
+  }
+  parameters[nparameters] = '\0';
+  if (c == -1) {
+    return -1;
+  }
+
+  if (c == '~' && introducer == '[') {
+    switch (atoi(parameters)) {
+    case 1:
+    case 7:
+      return KEY_HOME;
+    case 3:
+      return KEY_DELETE;
+    case 4:
+    case 8:
+      return KEY_END;
+    }
+    return KEY_UNKNOWN;
+  }
+
+  // 'ESC [ 1 ; 5 C' is Ctrl-Right, and ';3' Alt-Right.
+  bool word = (strstr(parameters, ";5") != NULL ||
+               strstr(parameters, ";3") != NULL);
+  switch (c) {
+  case 'A':
+    return KEY_UP;
+  case 'B':
+    return KEY_DOWN;
+  case 'C':
+    return word ? KEY_WORD_RIGHT : KEY_RIGHT;
+  case 'D':
+    return word ? KEY_WORD_LEFT : KEY_LEFT;
+  case 'H':
+    return KEY_HOME;
+  case 'F':
+    return KEY_END;
+  }
+  return KEY_UNKNOWN;
+}
+
+
+static bool input_pending() {
+  int n;
+  return ioctl(STDIN_FILENO, FIONREAD, &n) == 0 && n > 0;
+}
+
+
+// Find where the line starts after the prompt and how wide it's shown.
+static void measure(struct editor *e) {
+  struct winsize size;
+  int columns = DEFAULT_COLUMNS;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+    columns = size.ws_col;
+  }
+  if (columns > MAX_COLUMNS) {
+    columns = MAX_COLUMNS;
+  }
+
+  // the last column is never written, so the terminal doesn't wrap.
+  e->start = get_prompt_width(e->prompt) % columns;
+  e->width = columns - 1 - e->start;
+  if (e->width < 1) {
+    e->width = 1;
+  }
+}
+
+
+// Returns the number of columns 'prompt' takes, not counting the escape
+// sequences which color it.
+static int get_prompt_width(char *prompt) {
+  int width = 0;
+  for (char *s = prompt; *s != '\0'; s++) {
+    if (s[0] == ESCAPE && s[1] == '[') {
+      s += 2;
+      while (*s != '\0' && (*s < '@' || *s > '~')) {
+        s++;
+      }
+      if (*s == '\0') {
+        break;
+      }
+    } else if ((*s & 0xc0) != 0x80) {
+      width++;
+    }
+  }
+  return width;
+}
+
+
+// Draw the prompt again on the current row, the line is drawn by the
+// next refresh.
+static void redraw(struct editor *e) {
+  emit("\r", 1);
+  emit(e->prompt, strlen(e->prompt));
+  emit("\033[K", 3);
+  e->nshown = 0;
+  e->column = 0;
+}
+
+
+// Bring the screen up to date with the line, only the characters from
+// the first one which differs from what's shown are written.
+static void refresh(struct editor *e) {
+  // when the cursor goes past either edge, the line scrolls to put it
+  // half a screen from that edge.
+  if (e->first > e->cursor ||
+      count_cells(e, e->first, e->cursor, e->width) >= e->width) {
+    e->first = e->cursor;
+    for (int i = 0; i < e->width / 2 && e->first > 0; i++) {
+      e->first = previous_char(e, e->first);
+    }
+  }
+
+  uint64_t cells[MAX_COLUMNS];
+  int ncells = 0;
+  size_t i = e->first;
+  while (i < e->len && ncells < e->width) {
+    size_t next = next_char(e, i);
+    cells[ncells++] = pack_cell(&(*e->line)[i], next - i);
+    i = next;
+  }
+
+  // the rest of the newest history entry which starts with the line is
+  // shown dimmed after it while the cursor is at its end.
+  if (e->suggesting && e->history_index == -1 && e->cursor == e->len) {
+    int entry_len;
+    char *entry = suggest(*e->line, e->len, &entry_len);
+    size_t j = e->len;
+    while (entry != NULL && j < (size_t)entry_len && ncells < e->width) {
+      size_t next = j + 1;
+      while (next < (size_t)entry_len && (entry[next] & 0xc0) == 0x80) {
+        next++;
+      }
+      cells[ncells++] = pack_cell(&entry[j], next - j) | DIM_CELL;
+      j = next;
+    }
+  }
+
+  int same = 0;
+  while (same < ncells && same < e->nshown && cells[same] == e->shown[same]) {
+    same++;
+  }
+  if (same < ncells || same < e->nshown) {
+    // when nothing moved, what's the same at the end isn't written.
+    int end = ncells;
+    if (ncells == e->nshown) {
+      while (end > same && cells[end-1] == e->shown[end-1]) {
+        end--;
+      }
+    }
+    move_cursor(e, same);
+    emit_cells(&cells[same], end - same);
+    e->column = end;
+    if (e->nshown > ncells) {
+      emit("\033[K", 3);
+    }
+    memcpy(&e->shown[same], &cells[same], sizeof(*cells) * (ncells - same));
+    e->nshown = ncells;
+  }
+
+  move_cursor(e, count_cells(e, e->first, e->cursor, e->width));
+}
+
+
+// Move the cursor to 'column' after the prompt, with whichever of
+// backspaces, rewriting what's shown, or a cursor motion is shortest.
+static void move_cursor(struct editor *e, int column) {
+  char sequence[MAX_SEQUENCE];
+  int n = abs(column - e->column);
+  if (column < e->column) {
+    if (n <= 3) {
+      emit("\b\b\b", n);
+    } else {
+      emit(sequence, snprintf(sequence, sizeof(sequence), "\033[%dD", n));
+    }
+  } else if (column > e->column) {
+    if (n <= 3) {
+      emit_cells(&e->shown[e->column], n);
+    } else {
+      emit(sequence, snprintf(sequence, sizeof(sequence), "\033[%dC", n));
+    }
+  }
+  e->column = column;
+}
+
+
+static void emit(const char *s, size_t n) {
+  if (output_len + n > OUTPUT_SIZE) {
+    flush_output();
+  }
+  if (n > OUTPUT_SIZE) {
+    if (write(STDOUT_FILENO, s, n) == -1) {
+      perror("write");
+    }
+    return;
+  }
+  memcpy(&output[output_len], s, n);
+  output_len += n;
+}
+
+
+// Returns the cell of the character of 'n' bytes at 's'.
+static uint64_t pack_cell(const char *s, size_t n) {
+  uint64_t cell = 0;
+  for (size_t i = 0; i < n && i < 4; i++) {
+    cell |= (uint64_t)(unsigned char)s[i] << (8 * i);
+  }
+  return cell;
+}
+
+
+// Write 'n' cells, the dimmed ones between SGR 2 and SGR 0.
+static void emit_cells(const uint64_t *cells, int n) {
+  bool dim = false;
+  for (int i = 0; i < n; i++) {
+    bool dim_cell = (cells[i] & DIM_CELL) != 0;
+    if (dim_cell != dim) {
+      emit(dim_cell ? "\033[2m" : "\033[0m", 4);
+      dim = dim_cell;
+    }
+    char bytes[4];
+    int nbytes = 0;
+    for (uint64_t cell = cells[i]; nbytes < 4 && (cell & 0xff) != 0; cell >>= 8) {
+      bytes[nbytes++] = cell & 0xff;
+    }
+    emit(bytes, nbytes);
+  }
+  if (dim) {
+    emit("\033[0m", 4);
+  }
+}
+
+
+static void flush_output() {
+  size_t written = 0;
+  while (written < output_len) {
+    ssize_t n = write(STDOUT_FILENO, &output[written], output_len - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      break;
+    }
+    written += n;
+  }
+  output_len = 0;
+}
+
+
+// Returns the offset of the character after the one at 'i', UTF-8
+// continuation bytes belong to the character before them.
+static size_t next_char(struct editor *e, size_t i) {
+  if (i < e->len) {
+    i++;
+  }
+  while (i < e->len && ((*e->line)[i] & 0xc0) == 0x80) {
+    i++;
+  }
+  return i;
+}
+
+
+static size_t previous_char(struct editor *e, size_t i) {
+  if (i > 0) {
+    i--;
+  }
+  while (i > 0 && ((*e->line)[i] & 0xc0) == 0x80) {
+    i--;
+  }
+  return i;
+}
+
+
+// Returns the offset of the end of the word at or after 'i', words are
+// separated by blanks.
+static size_t next_word(struct editor *e, size_t i) {
+  char *text = *e->line;
+  while (i < e->len && (text[i] == ' ' || text[i] == '\t')) {
+    i++;
+  }
+  while (i < e->len && text[i] != ' ' && text[i] != '\t') {
+    i++;
+  }
+  return i;
+}
+
+
+static size_t previous_word(struct editor *e, size_t i) {
+  char *text = *e->line;
+  while (i > 0 && (text[i-1] == ' ' || text[i-1] == '\t')) {
+    i--;
+  }
+  while (i > 0 && text[i-1] != ' ' && text[i-1] != '\t') {
+    i--;
+  }
+  return i;
+}
+
+
+// Returns the number of characters between 'from' and 'to', counting
+// no further than 'limit'.
+static int count_cells(struct editor *e, size_t from, size_t to, int limit) {
+  int n = 0;
+  while (from < to && n < limit) {
+    from = next_char(e, from);
+    n++;
+  }
+  return n;
+}
+
+
+// Make the buffer hold at least 'len' bytes and the '\n' and NUL which
+// end the line.
+static void reserve(struct editor *e, size_t len) {
+  if (*e->line == NULL || *e->size < len + 2) {
+    size_t size = (*e->size > 0) ? *e->size : 128;
+    while (size < len + 2) {
+      size *= 2;
+    }
+    *e->line = realloc(*e->line, size);
+    *e->size = size;
+  }
+}
+
+
+static void insert(struct editor *e, const char *s, size_t n) {
+  reserve(e, e->len + n);
+  char *text = *e->line;
+  memmove(&text[e->cursor + n], &text[e->cursor], e->len - e->cursor);
+  memcpy(&text[e->cursor], s, n);
+  e->len += n;
+  e->cursor += n;
+}
+
+
+static void delete(struct editor *e, size_t from, size_t to) {
+  char *text = *e->line;
+  memmove(&text[from], &text[to], e->len - to);
+  e->len -= to - from;
+  e->cursor = from;
+}
+
+
+// Delete the text between 'from' and 'to', keeping it for Ctrl-Y.
+static void kill_text(struct editor *e, size_t from, size_t to) {
+  if (from == to) {
+    return;
+  }
+  killed = realloc(killed, to - from);
+  memcpy(killed, &(*e->line)[from], to - from);
+  killed_len = to - from;
+  delete(e, from, to);
+}
+
+
+// Replace the line with 'n' bytes of 's', with the cursor at its end.
+static void set_line(struct editor *e, const char *s, size_t n) {
+  reserve(e, n);
+  memcpy(*e->line, s, n);
+  e->len = n;
+  e->cursor = n;
+  e->first = 0;
+}
+
+
+// Show the history entry before the one shown if 'direction' is -1, or
+// the one after it if it's 1. The line being typed comes after the last
+// entry.
+static void recall(struct editor *e, int direction) {
+  int nlines = get_nlines();
+  int index = (e->history_index == -1) ? nlines : e->history_index;
+  index += direction;
+  if (index < 0 || index > nlines) {
+    return;
+  }
+
+  if (e->history_index == -1) {
+    e->saved = realloc(e->saved, e->len + 1);
+    memcpy(e->saved, *e->line, e->len);
+    e->saved_len = e->len;
+  }
+  if (index == nlines) {
+    set_line(e, e->saved, e->saved_len);
+    e->history_index = -1;
+    return;
+  }
+
+  int len;
+  char *entry = get_history_entry(index, &len);
+  if (entry == NULL) {
+    return;
+  }
+  if (len > 0 && entry[len-1] == '\n') {
+    len--;
+  }
+  set_line(e, entry, len);
+  e->history_index = index;
+}
+
+
+// Complete the word before the cursor as far as all of its matches
+// agree, a word with a single match is followed by a space. If it
+// can't be completed any further the terminal beeps, or the matches
+// are listed if 'list' is true.
+static void complete_word(struct editor *e, bool list) {
+  struct completion completion;
+  if (!complete(*e->line, e->cursor, &completion)) {
+    emit("\a", 1);
+    return;
+  }
+
+  // the completion starts with the word as it was typed.
+  size_t typed = e->cursor - completion.start;
+  size_t len = strlen(completion.common);
+  if (len > typed || completion.unique) {
+    insert(e, &completion.common[typed], len - typed);
+    if (completion.unique && (len == 0 || completion.common[len-1] != '/')) {
+      insert(e, " ", 1);
+    }
+  } else if (list) {
+    list_matches(e, &completion);
+  } else {
+    emit("\a", 1);
+  }
+}
+
+
+// Print the matches in columns below the line, sorted down the columns,
+// and draw the line again below them.
+static void list_matches(struct editor *e, struct completion *completion) {
+  int columns = e->start + e->width + 1;
+  int widest = 1;
+  for (int i = 0; i < completion->nlisted; i++) {
+    int len = strlen(completion->listed[i]);
+    widest = (len > widest) ? len : widest;
+  }
+  int ncolumns = columns / (widest + 2);
+  if (ncolumns < 1) {
+    ncolumns = 1;
+  }
+  int nrows = (completion->nlisted + ncolumns - 1) / ncolumns;
+
+  emit("\n", 1);
+  for (int row = 0; row < nrows; row++) {
+    for (int column = 0; column < ncolumns; column++) {
+      int i = column * nrows + row;
+      if (i >= completion->nlisted) {
+        break;
+      }
+      char *name = completion->listed[i];
+      emit(name, strlen(name));
+      // the last column isn't padded.
+      if (column < ncolumns - 1 && i + nrows < completion->nlisted) {
+        for (int pad = strlen(name); pad < widest + 2; pad++) {
+          emit(" ", 1);
+        }
+      }
+    }
+    emit("\n", 1);
+  }
+  if (completion->nmatches > completion->nlisted) {
+    char more[64];
+    emit(more, snprintf(more, sizeof(more), "... and %d more\n",
+                        completion->nmatches - completion->nlisted));
+  }
+  redraw(e);
+}
+
+
+// Append the rest of the suggested history entry to the line. Returns
+// false if nothing is suggested.
+static bool accept_suggestion(struct editor *e) {
+  if (!e->suggesting || e->history_index != -1) {
+    return false;
+  }
+  int entry_len;
+  char *entry = suggest(*e->line, e->len, &entry_len);
+  if (entry == NULL) {
+    return false;
+  }
+  e->cursor = e->len;
+  insert(e, &entry[e->len], entry_len - e->len);
+  return true;
+}
@@ -0,0 +1,40 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include <sys/types.h>
+
+//
+// Read a line typed on the terminal with emacs-style editing:
+//
+//     Ctrl-A, Ctrl-E        start and end of the line
+//     Ctrl-B, Ctrl-F        back and forward a character, also the arrows
+//     Alt-B, Alt-F          back and forward a word, also Ctrl-arrows
+//     Ctrl-H, Ctrl-D        delete the character before and at the cursor
+//     Ctrl-W, Alt-D         kill the word before and after the cursor
+//     Ctrl-U, Ctrl-K        kill to the start and to the end of the line
+//     Ctrl-Y                yank the text killed last
+//     Ctrl-P, Ctrl-N        the previous and next history entries, also
+//                           the up and down arrows
+//     Tab                   complete a command or file name, twice to
+//                           list the matches
+//     Ctrl-E, Right         at the end of the line, take the suggestion
+//     Ctrl-L                clear the screen
+//     Ctrl-C                abandon the line
+//
+// While the cursor is at the end of the line, the rest of the newest
+// history entry which starts with it is suggested, dimmed.
+//
+// The line is shown on a single row after the prompt and scrolls
+// sideways when it's longer, and only the characters which changed are
+// redrawn after a key, so the work done for each key is bounded by the
+// width of the terminal however long the line is.
+//
+// Prints 'prompt' and saves the line into '*line', which is grown with
+// realloc to '*size' bytes like getline does. Returns the length of the
+// line including its '\n', or -1 on Ctrl-D on an empty line or at the
+// end of input. Without a terminal, or on a dumb one, the prompt is
+// printed and the line is read from stdin with getline.
+//
+ssize_t edit_line(char *prompt, char **line, size_t *size);
+
+#endif
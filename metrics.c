@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "metrics.h"
+
+// the Prometheus file is written at most this often, in nanoseconds,
+// and when the shell exits.
+#define PROMETHEUS_INTERVAL 1000000000ULL
+
+
+// the totals of a program for Prometheus.
+struct program_totals {
+  char *name;
+  unsigned long runs;
+  unsigned long failures;
+  double wall_seconds;
+  double user_seconds;
+  double system_seconds;
+  long max_rss_kb;
+  unsigned long major_faults;
+};
+
+
+static char *phase_names[NPHASES] = {
+  [PHASE_PARSE] = "parse", [PHASE_GLOB] = "glob",
+  [PHASE_LOOKUP] = "lookup", [PHASE_SPAWN] = "spawn",
+};
+
+static bool metrics_enabled = false;
+// the JSON lines file, -1 if there's none.
+static int jsonl_fd = -1;
+// the Prometheus file, NULL if there's none.
+static char *prometheus_path = NULL;
+static uint64_t prometheus_written = 0;
+
+// time spent in each phase since the last job was spawned.
+static uint64_t pending_phases[NPHASES];
+// totals of every program, and of the phases, for Prometheus.
+static struct program_totals *totals = NULL;
+static int ntotals = 0;
+static uint64_t total_phases[NPHASES];
+
+
+static void write_json_record(char *command, struct process *processes,
+                              int nprocesses, uint64_t *phases);
+static void add_totals(struct process *processes, int nprocesses,
+                       uint64_t *phases);
+static void write_prometheus();
+static void write_prometheus_at_exit();
+static void print_json_string(FILE *stream, char *s);
+static void print_label(FILE *stream, char *s);
+static int get_exit_status(int status);
+static double to_seconds(struct timeval time);
+static double timeval_difference(struct timeval end, struct timeval start);
+
+
+void init_metrics() {
+  char *path = getenv("SIMSH_METRICS");
+  if (path != NULL && path[0] != '\0') {
+    jsonl_fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (jsonl_fd == -1) {
+      fprintf(stderr, "SIMSH_METRICS: %s: %s\n", path, strerror(errno));
+    }
+  }
+
+  path = getenv("SIMSH_METRICS_PROM");
+  if (path != NULL && path[0] != '\0') {
+    prometheus_path = strdup(path);
+    atexit(write_prometheus_at_exit);
+  }
+  metrics_enabled = (jsonl_fd != -1 || prometheus_path != NULL);
+}
+
+
+uint64_t metrics_clock() {
+  if (!metrics_enabled) {
+    return 0;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+void add_phase_time(enum shell_phase phase, uint64_t started) {
+  if (metrics_enabled) {
+    pending_phases[phase] += metrics_clock() - started;
+  }
+}
+
+
+void take_phase_times(uint64_t *phases) {
+  memcpy(phases, pending_phases, sizeof(pending_phases));
+  memset(pending_phases, 0, sizeof(pending_phases));
+}
+
+
+void record_metrics(char *command, struct process *processes, int nprocesses,
+                    uint64_t *phases) {
+  if (!metrics_enabled) {
+    return;
+  }
+  if (jsonl_fd != -1) {
+    write_json_record(command, processes, nprocesses, phases);
+  }
+  if (prometheus_path != NULL) {
+    add_totals(processes, nprocesses, phases);
+    if (metrics_clock() - prometheus_written >= PROMETHEUS_INTERVAL) {
+      write_prometheus();
+    }
+  }
+}
+
+
+void start_timing(struct timing *timing) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  timing->started = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  getrusage(RUSAGE_SELF, &timing->self);
+  getrusage(RUSAGE_CHILDREN, &timing->children);
+}
+
+
+void print_timing(struct timing *timing, bool posix) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double real = ((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec -
+                 timing->started) / 1e9;
+
+  // the shell's own time counts too, a builtin runs in it.
+  struct rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  double user = timeval_difference(self.ru_utime, timing->self.ru_utime) +
+                timeval_difference(children.ru_utime, timing->children.ru_utime);
+  double system = timeval_difference(self.ru_stime, timing->self.ru_stime) +
+                  timeval_difference(children.ru_stime, timing->children.ru_stime);
+
+  fflush(stdout);
+  if (posix) {
+    fprintf(stderr, "real %.2f\nuser %.2f\nsys %.2f\n", real, user, system);
+    return;
+  }
+  char *names[] = { "real", "user", "sys" };
+  double values[] = { real, user, system };
+  fprintf(stderr, "\n");
+  for (int i = 0; i < 3; i++) {
+    int minutes = (int) (values[i] / 60);
+    fprintf(stderr, "%s\t%dm%.3fs\n", names[i], minutes, values[i] - minutes * 60);
+  }
+}
+
+
+// Append a line for the job to the JSON lines file in a single write,
+// so the lines of shells sharing the file don't mix.
+static void write_json_record(char *command, struct process *processes,
+                              int nprocesses, uint64_t *phases) {
+  char *record;
+  size_t size;
+  FILE *stream = open_memstream(&record, &size);
+  if (stream == NULL) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  struct process *last = &processes[nprocesses - 1];
+  uint64_t started = processes[0].usage.started;
+  uint64_t finished = started;
+  for (int i = 0; i < nprocesses; i++) {
+    if (processes[i].usage.finished > finished) {
+      finished = processes[i].usage.finished;
+    }
+  }
+  fprintf(stream, "{\"time\":%ld.%03ld,\"command\":", (long) now.tv_sec,
+          now.tv_nsec / 1000000);
+  print_json_string(stream, command);
+  fprintf(stream, ",\"status\":%d,\"wall_us\":%llu,\"shell_us\":{",
+          get_exit_status(last->status),
+          (unsigned long long) (finished - started) / 1000);
+  for (int i = 0; i < NPHASES; i++) {
+    fprintf(stream, "%s\"%s\":%llu", (i > 0) ? "," : "", phase_names[i],
+            (unsigned long long) phases[i] / 1000);
+  }
+  fprintf(stream, "},\"processes\":[");
+
+  for (int i = 0; i < nprocesses; i++) {
+    struct process *process = &processes[i];
+    struct rusage *rusage = &process->usage.rusage;
+    fprintf(stream, "%s{\"pid\":%d,\"path\":", (i > 0) ? "," : "", process->pid);
+    print_json_string(stream, process->path);
+    fprintf(stream, ",\"status\":%d,\"wall_us\":%llu,\"user_us\":%.0f,"
+                    "\"sys_us\":%.0f,\"max_rss_kb\":%ld,\"minor_faults\":%ld,"
+                    "\"major_faults\":%ld,\"voluntary_switches\":%ld,"
+                    "\"involuntary_switches\":%ld}",
+            get_exit_status(process->status),
+            (unsigned long long) (process->usage.finished - process->usage.started) / 1000,
+            to_seconds(rusage->ru_utime) * 1e6, to_seconds(rusage->ru_stime) * 1e6,
+            rusage->ru_maxrss, rusage->ru_minflt, rusage->ru_majflt,
+            rusage->ru_nvcsw, rusage->ru_nivcsw);
+  }
+  fprintf(stream, "]}\n");
+  fclose(stream);
+
+  for (size_t written = 0; written < size; ) {
+    ssize_t n = write(jsonl_fd, record + written, size - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      break;
+    }
+    written += n;
+  }
+  free(record);
+}
+
+
+// Add the programs of a job to the totals of their names.
+static void add_totals(struct process *processes, int nprocesses,
+                       uint64_t *phases) {
+  for (int i = 0; i < NPHASES; i++) {
+    total_phases[i] += phases[i];
+  }
+
+  for (int i = 0; i < nprocesses; i++) {
+    struct process *process = &processes[i];
+    char *name = strrchr(process->path, '/');
+    name = (name != NULL) ? name + 1 : process->path;
+    if (name[0] == '\0') {
+      continue;
+    }
+
+    int j = 0;
+    while (j < ntotals && strcmp(totals[j].name, name) != 0) {
+      j++;
+    }
+    if (j == ntotals) {
+      totals = realloc(totals, sizeof(*totals) * (ntotals + 1));
+      memset(&totals[j], 0, sizeof(*totals));
+      totals[j].name = strdup(name);
+      ntotals++;
+    }
+
+    struct program_totals *program = &totals[j];
+    struct rusage *rusage = &process->usage.rusage;
+    program->runs++;
+    program->failures += (get_exit_status(process->status) != 0);
+    program->wall_seconds += (process->usage.finished - process->usage.started) / 1e9;
+    program->user_seconds += to_seconds(rusage->ru_utime);
+    program->system_seconds += to_seconds(rusage->ru_stime);
+    program->major_faults += rusage->ru_majflt;
+    if (rusage->ru_maxrss > program->max_rss_kb) {
+      program->max_rss_kb = rusage->ru_maxrss;
+    }
+  }
+}
+
+
+// Replace the Prometheus file with the totals, through a new file
+// renamed over it so the collector never reads half of it.
+static void write_prometheus() {
+  prometheus_written = metrics_clock();
+
+  size_t length = strlen(prometheus_path);
+  char temporary[length + 5];
+  strcpy(stpcpy(temporary, prometheus_path), ".tmp");
+  FILE *stream = fopen(temporary, "we");
+  if (stream == NULL) {
+    return;
+  }
+
+  static struct {
+    char *name;
+    char *type;
+    char *help;
+  } metrics[] = {
+    { "simsh_program_runs_total", "counter", "Programs run." },
+    { "simsh_program_failures_total", "counter", "Programs which exited with a non-zero status." },
+    { "simsh_program_wall_seconds_total", "counter", "Time programs ran for." },
+    { "simsh_program_cpu_seconds_total", "counter", "CPU time used by programs." },
+    { "simsh_program_max_rss_bytes", "gauge", "Largest resident set of a run of the program." },
+    { "simsh_program_major_faults_total", "counter", "Page faults which needed I/O." },
+  };
+  for (int i = 0; i < 6; i++) {
+    fprintf(stream, "# HELP %s %s\n# TYPE %s %s\n", metrics[i].name,
+            metrics[i].help, metrics[i].name, metrics[i].type);
+    for (int j = 0; j < ntotals; j++) {
+      struct program_totals *program = &totals[j];
+      fprintf(stream, "%s{program=\"", metrics[i].name);
+      print_label(stream, program->name);
+      switch (i) {
+      case 0:
+        fprintf(stream, "\"} %lu\n", program->runs);
+        break;
+      case 1:
+        fprintf(stream, "\"} %lu\n", program->failures);
+        break;
+      case 2:
+        fprintf(stream, "\"} %.6f\n", program->wall_seconds);
+        break;
+      case 3:
+        fprintf(stream, "\",mode=\"user\"} %.6f\n", program->user_seconds);
+        fprintf(stream, "%s{program=\"", metrics[i].name);
+        print_label(stream, program->name);
+        fprintf(stream, "\",mode=\"system\"} %.6f\n", program->system_seconds);
+        break;
+      case 4:
+        fprintf(stream, "\"} %ld\n", program->max_rss_kb * 1024);
+        break;
+      case 5:
+        fprintf(stream, "\"} %lu\n", program->major_faults);
+        break;
+      }
+    }
+  }
+
+  fprintf(stream, "# HELP simsh_shell_phase_seconds_total Time the shell spent "
+                  "running commands itself.\n"
+                  "# TYPE simsh_shell_phase_seconds_total counter\n");
+  for (int i = 0; i < NPHASES; i++) {
+    fprintf(stream, "simsh_shell_phase_seconds_total{phase=\"%s\"} %.9f\n",
+            phase_names[i], total_phases[i] / 1e9);
+  }
+
+  if (fclose(stream) == EOF || rename(temporary, prometheus_path) == -1) {
+    unlink(temporary);
+  }
+}
+
+
+static void write_prometheus_at_exit() {
+  if (ntotals > 0) {
+    write_prometheus();
+  }
+}
+
+
+// Print 's' as a JSON string.
+static void print_json_string(FILE *stream, char *s) {
+  fputc('"', stream);
+  for (unsigned char *c = (unsigned char *) s; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(stream, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(stream, "\\u%04x", *c);
+    } else {
+      fputc(*c, stream);
+    }
+  }
+  fputc('"', stream);
+}
+
+
+// Print 's' as the value of a Prometheus label, without the quotes.
+static void print_label(FILE *stream, char *s) {
+  for (char *c = s; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(stream, "\\%c", *c);
+    } else if (*c == '\n') {
+      fputs("\\n", stream);
+    } else {
+      fputc(*c, stream);
+    }
+  }
+}
+
+
+// Returns the exit status of a program from what waitpid returned.
+static int get_exit_status(int status) {
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+
+static double to_seconds(struct timeval time) {
+  return time.tv_sec + time.tv_usec / 1e6;
+}
+
+
+static double timeval_difference(struct timeval end, struct timeval start) {
+  return to_seconds(end) - to_seconds(start);
+}
@@ -0,0 +1,84 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+//
+// Accounting of what every command costs. When SIMSH_METRICS names a
+// file, a line of JSON is appended to it for every job that finishes,
+// with the wall time, CPU time, memory, page faults and context
+// switches of each of its programs as reported by wait4, and the time
+// the shell spent parsing, globbing, looking up and spawning it. When
+// SIMSH_METRICS_PROM names a file, the totals of every program are
+// kept in it in the Prometheus text format, for the textfile collector
+// of node_exporter.
+//
+
+
+// The steps the shell itself takes to run a command.
+enum shell_phase {
+  PHASE_PARSE,   // tokenize the line and parse it
+  PHASE_GLOB,    // expand the words
+  PHASE_LOOKUP,  // find the programs
+  PHASE_SPAWN,   // start them
+  NPHASES,
+};
+
+
+// When a program ran and what it used.
+struct process_usage {
+  // CLOCK_MONOTONIC in nanoseconds, 0 if metrics aren't kept.
+  uint64_t started;
+  uint64_t finished;
+  // as returned by wait4.
+  struct rusage rusage;
+};
+
+
+// Where 'time' started counting from.
+struct timing {
+  uint64_t started;
+  struct rusage self;
+  struct rusage children;
+};
+
+
+struct process;
+
+
+// Open the files named by SIMSH_METRICS and SIMSH_METRICS_PROM, the
+// Prometheus file is written one last time when the shell exits.
+void init_metrics();
+
+
+// Returns CLOCK_MONOTONIC in nanoseconds, or 0 if metrics aren't kept.
+uint64_t metrics_clock();
+
+
+// Add the time since 'started', a value of 'metrics_clock', to the
+// time spent in 'phase' for the next job.
+void add_phase_time(enum shell_phase phase, uint64_t started);
+
+
+// Move the time spent in each phase since the last call into 'phases',
+// which has NPHASES entries. Call this once a job is spawned.
+void take_phase_times(uint64_t *phases);
+
+
+// Record the programs of a finished job, 'command' as it was typed and
+// 'phases' the time the shell spent on it.
+void record_metrics(char *command, struct process *processes, int nprocesses,
+                    uint64_t *phases);
+
+
+// Save the time and the CPU time used so far into 'timing'.
+void start_timing(struct timing *timing);
+
+
+// Print the time and CPU time used since 'start_timing' to stderr, in
+// the format of POSIX if 'posix' is true.
+void print_timing(struct timing *timing, bool posix);
+
+#endif
@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "helper.h"
+#include "execcache.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "simsh.h"
+#include "parallel.h"
+
+// the most commands reported one by one in the summary.
+#define MAX_FAILURES_SHOWN 10
+
+
+// a run of the command for one argument.
+struct task {
+  char *argument;
+  pid_t pid;
+  int status;
+  bool finished;
+  // where its output is kept until it's printed, -1 if it isn't.
+  int out_fd;
+  int err_fd;
+  struct process_usage usage;
+};
+
+
+static int read_arguments(int fd, char ***arguments, char **buffer);
+static char **build_argv(char **template, char *argument);
+static bool start_task(struct task *task, char **template, char **path,
+                       char **environment, bool group_output);
+static void record_task(struct task *task, char **template, int status);
+static void print_output(struct task *task);
+static void copy_fd(int from, int to);
+static int print_summary(struct task *tasks, int ntasks, char **template);
+
+
+int do_parallel(char **words, char **path, char **environment) {
+  long nslots = sysconf(_SC_NPROCESSORS_ONLN);
+  bool group_output = false;
+  bool keep_order = false;
+  char *argument_file = NULL;
+
+  int i = 1;
+  for (; words[i] != NULL && words[i][0] == '-'; i++) {
+    if (strcmp(words[i], "-j") == 0 && words[i+1] != NULL &&
+        is_integer(words[i+1])) {
+      nslots = atol(words[++i]);
+    } else if (strncmp(words[i], "-j", 2) == 0 && words[i][2] != '\0' &&
+               is_integer(&words[i][2])) {
+      nslots = atol(&words[i][2]);
+    } else if (strcmp(words[i], "-g") == 0) {
+      group_output = true;
+    } else if (strcmp(words[i], "-k") == 0) {
+      // the output can only be kept in order if it's kept at all.
+      group_output = true;
+      keep_order = true;
+    } else if (strcmp(words[i], "-a") == 0 && words[i+1] != NULL) {
+      argument_file = words[++i];
+    } else if (strcmp(words[i], "--") == 0) {
+      i++;
+      break;
+    } else {
+      fprintf(stderr, "parallel: %s: invalid option\n", words[i]);
+      return 2;
+    }
+  }
+  if (nslots < 1) {
+    nslots = 1;
+  }
+
+  // the command runs up to ':::', which is followed by the arguments.
+  char **template = &words[i];
+  int ntemplate = 0;
+  while (template[ntemplate] != NULL && strcmp(template[ntemplate], ":::") != 0) {
+    ntemplate++;
+  }
+  if (ntemplate == 0) {
+    fprintf(stderr, "parallel: no command given\n");
+    return 2;
+  }
+
+  char **arguments;
+  char *buffer = NULL;
+  int narguments;
+  if (template[ntemplate] != NULL) {
+    arguments = &template[ntemplate + 1];
+    narguments = count_nwords(arguments);
+  } else {
+    int fd = STDIN_FILENO;
+    if (argument_file != NULL && (fd = open(argument_file, O_RDONLY|O_CLOEXEC)) == -1) {
+      perror(argument_file);
+      return 2;
+    }
+    narguments = read_arguments(fd, &arguments, &buffer);
+    if (fd != STDIN_FILENO) {
+      close(fd);
+    }
+  }
+  // the template is cut off at ':::' for 'build_argv'.
+  char *separator = template[ntemplate];
+  template[ntemplate] = NULL;
+
+  struct task *tasks = calloc(narguments + 1, sizeof(*tasks));
+  for (int j = 0; j < narguments; j++) {
+    tasks[j].argument = arguments[j];
+    tasks[j].pid = -1;
+    tasks[j].out_fd = -1;
+    tasks[j].err_fd = -1;
+  }
+
+  // output of builtins still buffered must come before the commands'.
+  fflush(stdout);
+
+  int next = 0;
+  int next_printed = 0;
+  int nrunning = 0;
+  while (next < narguments || nrunning > 0) {
+    // fill every free slot.
+    while (nrunning < nslots && next < narguments) {
+      struct task *task = &tasks[next++];
+      if (start_task(task, template, path, environment, group_output)) {
+        nrunning++;
+      } else if (group_output && !keep_order) {
+        print_output(task);
+      }
+    }
+
+    if (nrunning > 0) {
+      int status;
+      struct rusage rusage;
+      pid_t pid = wait4(-1, &status, WUNTRACED, &rusage);
+      if (pid == -1 && errno == EINTR) {
+        continue;
+      }
+      if (pid == -1) {
+        perror("parallel: wait4");
+        break;
+      }
+
+      struct task *task = NULL;
+      for (int j = next_printed; j < next && task == NULL; j++) {
+        if (tasks[j].pid == pid && !tasks[j].finished) {
+          task = &tasks[j];
+        }
+      }
+      if (task == NULL) {
+        // a program of a background job.
+        update_job_status(pid, status, &rusage);
+        continue;
+      }
+      if (WIFSTOPPED(status)) {
+        // the shell can't take over a command of a running builtin,
+        // it's let go on.
+        kill(pid, SIGCONT);
+        continue;
+      }
+
+      task->status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                       : 128 + WTERMSIG(status);
+      task->finished = true;
+      task->usage.finished = metrics_clock();
+      task->usage.rusage = rusage;
+      record_task(task, template, status);
+      nrunning--;
+      if (group_output && !keep_order) {
+        print_output(task);
+      }
+    }
+
+    // print the output of the commands finished in argument order.
+    while (keep_order && next_printed < next && tasks[next_printed].finished) {
+      print_output(&tasks[next_printed++]);
+    }
+    while (!keep_order && next_printed < next && tasks[next_printed].finished) {
+      next_printed++;
+    }
+  }
+
+  int status = print_summary(tasks, narguments, template);
+  template[ntemplate] = separator;
+  free(tasks);
+  if (buffer != NULL) {
+    free(arguments);
+    free(buffer);
+  }
+  return status;
+}
+
+
+// Read the lines of 'fd' as the arguments, saves them into 'arguments'
+// and the buffer they're in into 'buffer'. Returns how many there are.
+static int read_arguments(int fd, char ***arguments, char **buffer) {
+  size_t size = 4096;
+  size_t length = 0;
+  *buffer = malloc(size);
+
+  ssize_t nread;
+  while ((nread = read(fd, *buffer + length, size - length - 1)) != 0) {
+    if (nread == -1 && errno == EINTR) {
+      continue;
+    }
+    if (nread == -1) {
+      perror("parallel: read");
+      break;
+    }
+    length += nread;
+    if (length + 1 == size) {
+      size *= 2;
+      *buffer = realloc(*buffer, size);
+    }
+  }
+  (*buffer)[length] = '\0';
+
+  int nlines = 0;
+  for (size_t i = 0; i < length; i++) {
+    nlines += ((*buffer)[i] == '\n');
+  }
+  *arguments = malloc(sizeof(char *) * (nlines + 2));
+
+  // every line is an argument, empty ones are skipped.
+  int narguments = 0;
+  for (char *line = *buffer; *line != '\0'; ) {
+    char *end = strchrnul(line, '\n');
+    bool last = (*end == '\0');
+    *end = '\0';
+    if (end > line) {
+      (*arguments)[narguments++] = line;
+    }
+    line = last ? end : end + 1;
+  }
+  (*arguments)[narguments] = NULL;
+  return narguments;
+}
+
+
+// Returns the argv of the command for 'argument', in which every '{}'
+// of 'template' is replaced by it, or which ends with it if there is
+// no '{}'. The array and its strings are malloc'ed as a single block.
+static char **build_argv(char **template, char *argument) {
+  int nwords = count_nwords(template);
+  size_t argument_length = strlen(argument);
+
+  bool replaced = false;
+  size_t size = sizeof(char *) * (nwords + 2) + argument_length + 1;
+  for (int i = 0; i < nwords; i++) {
+    size += strlen(template[i]) + 1;
+    for (char *c = strstr(template[i], "{}"); c != NULL; c = strstr(c + 2, "{}")) {
+      size += argument_length;
+      replaced = true;
+    }
+  }
+
+  char **argv = malloc(size);
+  char *end = (char *) &argv[nwords + 2];
+  int argc = 0;
+  for (int i = 0; i < nwords; i++) {
+    argv[argc++] = end;
+    char *word = template[i];
+    for (char *c; (c = strstr(word, "{}")) != NULL; word = c + 2) {
+      end = mempcpy(end, word, c - word);
+      end = mempcpy(end, argument, argument_length);
+    }
+    end = stpcpy(end, word) + 1;
+  }
+  if (!replaced) {
+    argv[argc++] = strcpy(end, argument);
+  }
+  argv[argc] = NULL;
+  return argv;
+}
+
+
+// Spawn the command for 'task', with its output kept in memory files
+// if 'group_output' is true. Returns false if it couldn't be spawned,
+// the task is finished then.
+static bool start_task(struct task *task, char **template, char **path,
+                       char **environment, bool group_output) {
+  char **argv = build_argv(template, task->argument);
+
+  struct fd_action actions[2];
+  int nactions = 0;
+  if (group_output) {
+    task->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+    task->err_fd = memfd_create("parallel", MFD_CLOEXEC);
+    if (task->out_fd != -1 && task->err_fd != -1) {
+      actions[nactions++] = (struct fd_action){ task->out_fd, STDOUT_FILENO };
+      actions[nactions++] = (struct fd_action){ task->err_fd, STDERR_FILENO };
+    }
+  }
+
+  // the program is found in the hash table once it's been run.
+  char executable_path[PATH_MAX];
+  task->pid = -1;
+  if (strchr(argv[0], '/') != NULL) {
+    snprintf(executable_path, PATH_MAX, "%s", argv[0]);
+  } else if (!executable_exists(path, argv[0], executable_path)) {
+    fprintf(stderr, "%s: command not found\n", argv[0]);
+    task->status = 127;
+    task->finished = true;
+    free(argv);
+    return false;
+  }
+
+  task->usage.started = metrics_clock();
+  task->pid = exec_cache_spawn(executable_path, argv, environment,
+                               actions, nactions, NULL);
+  if (task->pid == -1) {
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    task->status = 127;
+    task->finished = true;
+  }
+  free(argv);
+  return task->pid != -1;
+}
+
+
+// Record what the command of a finished task used, 'status' is as
+// returned by wait4.
+static void record_task(struct task *task, char **template, int status) {
+  // no time is taken if metrics aren't kept.
+  if (task->usage.started == 0) {
+    return;
+  }
+
+  char **argv = build_argv(template, task->argument);
+  size_t size = 1;
+  for (int i = 0; argv[i] != NULL; i++) {
+    size += strlen(argv[i]) + 1;
+  }
+  char command[size];
+  char *end = stpcpy(command, argv[0]);
+  for (int i = 1; argv[i] != NULL; i++) {
+    end = stpcpy(stpcpy(end, " "), argv[i]);
+  }
+
+  struct process process = {
+    .pid = task->pid, .path = argv[0], .status = status, .completed = true,
+    .usage = task->usage,
+  };
+  uint64_t phases[NPHASES] = { 0 };
+  record_metrics(command, &process, 1, phases);
+  free(argv);
+}
+
+
+// Print the output kept for a finished task, and free it.
+static void print_output(struct task *task) {
+  if (task->out_fd != -1) {
+    copy_fd(task->out_fd, STDOUT_FILENO);
+    close(task->out_fd);
+    task->out_fd = -1;
+  }
+  if (task->err_fd != -1) {
+    copy_fd(task->err_fd, STDERR_FILENO);
+    close(task->err_fd);
+    task->err_fd = -1;
+  }
+}
+
+
+// Copy the whole file 'from' to 'to'.
+static void copy_fd(int from, int to) {
+  char buffer[65536];
+  ssize_t nread;
+  off_t offset = 0;
+  while ((nread = pread(from, buffer, sizeof(buffer), offset)) > 0) {
+    offset += nread;
+    for (ssize_t written = 0; written < nread; ) {
+      ssize_t n = write(to, buffer + written, nread - written);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1) {
+        return;
+      }
+      written += n;
+    }
+  }
+}
+
+
+// Prints the commands which failed and how many there were, which is
+// returned, up to 101.
+static int print_summary(struct task *tasks, int ntasks, char **template) {
+  int nfailed = 0;
+  for (int i = 0; i < ntasks; i++) {
+    if (tasks[i].status == 0) {
+      continue;
+    }
+    if (++nfailed <= MAX_FAILURES_SHOWN) {
+      char **argv = build_argv(template, tasks[i].argument);
+      fprintf(stderr, "parallel: exit status %d:", tasks[i].status);
+      for (int j = 0; argv[j] != NULL; j++) {
+        fprintf(stderr, " %s", argv[j]);
+      }
+      fprintf(stderr, "\n");
+      free(argv);
+    }
+  }
+
+  if (nfailed > 0 || show_exit_status) {
+    fprintf(stderr, "parallel: %d of %d commands failed\n", nfailed, ntasks);
+  }
+  return (nfailed < 101) ? nfailed : 101;
+}
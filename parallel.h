@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+//
+// Implement the 'parallel' shell built-in, which runs a command once
+// for every argument, with at most N of them running at once.
+//
+// Synopsis: parallel [-j N] [-g] [-k] [-a file] command [arg...] [::: arg...]
+// Examples:
+//     % parallel -j 4 gzip ::: *.log
+//     % parallel -k -a hosts ping -c 1 {}
+//
+// '{}' in the command is replaced by the argument, which is appended
+// to the command if there is no '{}'. The arguments follow ':::', or
+// are the lines of the '-a' file or of stdin. '-g' prints the output
+// of every command at once when it finishes, '-k' in the order of the
+// arguments. Returns the number of commands which failed, at most 101.
+//
+int do_parallel(char **words, char **path, char **environment);
+
+#endif
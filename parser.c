@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+
+#include "helper.h"
+#include "parser.h"
+
+
+// operators made of more than one special character, each before the
+// ones it starts with.
+static char *long_operators[] = {
+  "&>>", "<<<", "<<-", ">>", "<<", "&&", "||", "&>", "<>", ">&", "<&", NULL
+};
+
+// the redirection operators and the descriptor they redirect when it
+// isn't given before them.
+static struct {
+  char *operator;
+  enum redirection_type type;
+  int fd;
+} redirection_operators[] = {
+  { "<", REDIRECT_INPUT, 0 },
+  { ">", REDIRECT_OUTPUT, 1 },
+  { ">>", REDIRECT_APPEND, 1 },
+  { "<>", REDIRECT_READ_WRITE, 0 },
+  { "<&", REDIRECT_DUPLICATE, 0 },
+  { ">&", REDIRECT_DUPLICATE, 1 },
+  { "&>", REDIRECT_OUTPUT, 1 },
+  { "&>>", REDIRECT_APPEND, 1 },
+  { "<<", REDIRECT_HERE_DOCUMENT, 0 },
+  { "<<-", REDIRECT_HERE_DOCUMENT_INDENTED, 0 },
+  { "<<<", REDIRECT_HERE_STRING, 0 },
+  { NULL, 0, 0 },
+};
+
+
+static char *next_token(char **s, char *separators, char *special_chars,
+                        size_t *token_length);
+static size_t get_operator_length(char *s);
+static int get_redirection(char *token, struct redirection *redirection);
+static int complete_redirection(char *operator, struct redirection *redirection,
+                                struct redirection *extra);
+static enum connector get_connector(char *token);
+static bool is_operator(char *token);
+static void print_syntax_error(char *token);
+
+
+char **tokenize(struct arena *arena, char *s, char *separators,
+                char *special_chars) {
+  // count the tokens first so the array is allocated once.
+  size_t n_tokens = 0;
+  size_t token_length;
+  char *rest = s;
+  while (next_token(&rest, separators, special_chars, &token_length) != NULL) {
+    n_tokens++;
+  }
+
+  char **tokens = arena_alloc(arena, (n_tokens + 1) * sizeof *tokens);
+
+  rest = s;
+  for (size_t i = 0; i < n_tokens; i++) {
+    char *token = next_token(&rest, separators, special_chars, &token_length);
+    tokens[i] = arena_strndup(arena, token, token_length);
+  }
+  tokens[n_tokens] = NULL;
+
+  return tokens;
+}
+
+
+struct command_list *parse_command(char **tokens) {
+  // every word, operator and NULL terminator takes at most one slot
+  // of each array, so they are allocated once for the whole line.
+  int ntokens = count_nwords(tokens);
+  struct command_list *list = arena_alloc(&command_arena, sizeof(*list));
+  list->pipelines = arena_alloc(&command_arena,
+                                sizeof(struct pipeline) * (ntokens + 1));
+  list->npipelines = 0;
+
+  struct stage *stages = arena_alloc(&command_arena,
+                                     sizeof(struct stage) * (ntokens + 1));
+  char **words = arena_alloc(&command_arena, sizeof(char *) * (ntokens + 1));
+  // '&> file' takes two redirections.
+  struct redirection *redirections = arena_alloc(
+      &command_arena, sizeof(struct redirection) * (ntokens + 1));
+  int nstages = 0;
+  int nwords = 0;
+  int nredirections = 0;
+
+  if (ntokens == 0) {
+    return list;
+  }
+
+  struct pipeline *pipeline = &list->pipelines[0];
+  pipeline->stages = &stages[0];
+  pipeline->nstages = 0;
+
+  struct stage *stage = &stages[0];
+  stage->argv = &words[0];
+  stage->argc = 0;
+  stage->redirections = &redirections[0];
+  stage->nredirections = 0;
+
+  for (int i = 0; ; i++) {
+    char *token = tokens[i];
+
+    if (token != NULL && get_redirection(token, &redirections[nredirections])) {
+      // the next word is the file to redirect to.
+      if (tokens[i+1] == NULL || is_operator(tokens[i+1])) {
+        print_syntax_error(tokens[i+1]);
+        return NULL;
+      }
+      struct redirection *redirection = &redirections[nredirections];
+      redirection->target = tokens[++i];
+      int nextra = complete_redirection(token, redirection, redirection + 1);
+      if (nextra == -1) {
+        return NULL;
+      }
+      nredirections += 1 + nextra;
+      stage->nredirections += 1 + nextra;
+      continue;
+    }
+
+    if (token != NULL && !is_operator(token)) {
+      words[nwords++] = token;
+      stage->argc++;
+      continue;
+    }
+
+    // the end of a stage.
+    enum connector connector = (token != NULL) ? get_connector(token) : CONNECT_END;
+    if (token != NULL && strcmp(token, "|") != 0 && connector == CONNECT_END) {
+      print_syntax_error(token);
+      return NULL;
+    }
+
+    bool empty = (stage->argc == 0 && stage->nredirections == 0);
+    if (empty) {
+      // only a trailing ';' or '&' may be followed by nothing.
+      enum connector last = (list->npipelines > 0) ?
+          list->pipelines[list->npipelines-1].connector : CONNECT_END;
+      bool trailing = (token == NULL && pipeline->nstages == 0 &&
+                       (last == CONNECT_SEQUENCE || last == CONNECT_BACKGROUND));
+      if (!trailing) {
+        print_syntax_error(token);
+        return NULL;
+      }
+      if (last == CONNECT_SEQUENCE) {
+        list->pipelines[list->npipelines-1].connector = CONNECT_END;
+      }
+      break;
+    }
+
+    words[nwords++] = NULL;
+    pipeline->nstages++;
+    nstages++;
+
+    if (token == NULL || strcmp(token, "|") != 0) {
+      // the end of a pipeline.
+      pipeline->connector = connector;
+      list->npipelines++;
+      if (token == NULL) {
+        break;
+      }
+      pipeline = &list->pipelines[list->npipelines];
+      pipeline->stages = &stages[nstages];
+      pipeline->nstages = 0;
+    }
+
+    stage = &stages[nstages];
+    stage->argv = &words[nwords];
+    stage->argc = 0;
+    stage->redirections = &redirections[nredirections];
+    stage->nredirections = 0;
+  }
+
+  return list;
+}
+
+
+//
+// Find the next token in '*s', returns its start and saves its length
+// into 'token_length', or returns NULL if there are no more tokens.
+// '*s' is moved past the token.
+//
+static char *next_token(char **s, char *separators, char *special_chars,
+                        size_t *token_length) {
+  // We are pointing at zero or more of any of the separators.
+  // Skip leading instances of the separators.
+  *s += strspn(*s, separators);
+
+  // Now, 's' points at one or more characters we want to keep.
+  // The number of non-separator characters is the token length.
+  //
+  // Trailing separators after the last token mean that, at this
+  // point, we are looking at the end of the string, so:
+  if (**s == '\0') {
+    return NULL;
+  }
+
+  char *token = *s;
+  size_t length = strcspn(token, separators);
+  size_t length_without_special_chars = strcspn(token, special_chars);
+
+  if (length_without_special_chars == 0) {
+    // special characters are returned as single words, unless they
+    // start an operator.
+    length_without_special_chars = get_operator_length(token);
+  } else if (strspn(token, "0123456789") == length_without_special_chars &&
+             (token[length_without_special_chars] == '<' ||
+              token[length_without_special_chars] == '>')) {
+    // the descriptor a redirection applies to.
+    length_without_special_chars +=
+        get_operator_length(&token[length_without_special_chars]);
+  }
+
+  if (length_without_special_chars < length) {
+    length = length_without_special_chars;
+  }
+
+  *s += length;
+  *token_length = length;
+  return token;
+}
+
+
+// Returns the length of the operator at the start of 's', which is
+// a special character.
+static size_t get_operator_length(char *s) {
+  for (int i = 0; long_operators[i] != NULL; i++) {
+    size_t operator_length = strlen(long_operators[i]);
+    if (strncmp(s, long_operators[i], operator_length) == 0) {
+      return operator_length;
+    }
+  }
+  return 1;
+}
+
+
+// Returns true and fills in the fd and type of 'redirection' if
+// 'token' is a redirection operator, with or without a descriptor
+// before it.
+static int get_redirection(char *token, struct redirection *redirection) {
+  size_t ndigits = strspn(token, "0123456789");
+  for (int i = 0; redirection_operators[i].operator != NULL; i++) {
+    char *operator = redirection_operators[i].operator;
+    // '&>' always redirects both stdout and stderr.
+    if (strcmp(&token[ndigits], operator) != 0 ||
+        (ndigits > 0 && operator[0] == '&')) {
+      continue;
+    }
+
+    redirection->type = redirection_operators[i].type;
+    redirection->fd = redirection_operators[i].fd;
+    redirection->body = NULL;
+    if (ndigits > 0) {
+      // a descriptor too large to exist is left for the redirection
+      // to fail on.
+      long fd = strtol(token, NULL, 10);
+      redirection->fd = (fd > INT_MAX) ? INT_MAX : fd;
+    }
+    return true;
+  }
+  return false;
+}
+
+
+// Settle what the redirection by 'operator' to its target does: a copy
+// of '-' closes the descriptor, and '&>', or '>&' followed by a file,
+// sends both stdout and stderr to the file through a second
+// redirection saved into 'extra'. Returns how many redirections were
+// added to 'extra', or -1 and prints a message if the target isn't
+// valid.
+static int complete_redirection(char *operator, struct redirection *redirection,
+                                struct redirection *extra) {
+  char *target = redirection->target;
+  bool both = (operator[0] == '&');
+  if (redirection->type == REDIRECT_DUPLICATE) {
+    if (strcmp(target, "-") == 0) {
+      redirection->type = REDIRECT_CLOSE;
+    } else if (target[0] != '\0' && strspn(target, "0123456789") == strlen(target)) {
+      // a descriptor to copy.
+    } else if (strcmp(operator, ">&") == 0) {
+      redirection->type = REDIRECT_OUTPUT;
+      both = true;
+    } else {
+      fprintf(stderr, "%s: ambiguous redirect\n", target);
+      return -1;
+    }
+  }
+
+  if (!both) {
+    return 0;
+  }
+  *extra = (struct redirection){ 2, REDIRECT_DUPLICATE, "1", NULL };
+  return 1;
+}
+
+
+// Returns the connector 'token' stands for, CONNECT_END if it's none.
+static enum connector get_connector(char *token) {
+  if (strcmp(token, ";") == 0) {
+    return CONNECT_SEQUENCE;
+  } else if (strcmp(token, "&&") == 0) {
+    return CONNECT_AND;
+  } else if (strcmp(token, "||") == 0) {
+    return CONNECT_OR;
+  } else if (strcmp(token, "&") == 0) {
+    return CONNECT_BACKGROUND;
+  }
+  return CONNECT_END;
+}
+
+
+// Returns true if 'token' is an operator, which can't be a word.
+static bool is_operator(char *token) {
+  struct redirection redirection;
+  return strcmp(token, "|") == 0 || get_connector(token) != CONNECT_END ||
+         get_redirection(token, &redirection);
+}
+
+
+static void print_syntax_error(char *token) {
+  fprintf(stderr, "syntax error near unexpected token `%s'\n",
+          (token != NULL) ? token : "newline");
+}
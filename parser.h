@@ -0,0 +1,90 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+// How a redirection connects a file descriptor of a command.
+enum redirection_type {
+  REDIRECT_INPUT,       // fd < file
+  REDIRECT_OUTPUT,      // fd > file
+  REDIRECT_APPEND,      // fd >> file
+  REDIRECT_READ_WRITE,  // fd <> file
+  REDIRECT_DUPLICATE,   // fd >& n or fd <& n, fd becomes a copy of n
+  REDIRECT_CLOSE,       // fd >& - or fd <& -
+  REDIRECT_HERE_DOCUMENT,           // fd << word
+  REDIRECT_HERE_DOCUMENT_INDENTED,  // fd <<- word, without leading tabs
+  REDIRECT_HERE_STRING,             // fd <<< word
+};
+
+
+// '&> file' is saved as '> file' followed by '2>&1'.
+struct redirection {
+  int fd;
+  enum redirection_type type;
+  // the file, the descriptor to copy, '-', or the word of a
+  // here-document or here-string.
+  char *target;
+  // the text of a here-document or here-string, NULL for the others.
+  char *body;
+};
+
+
+// A single command of a pipeline, its redirections are applied in order.
+struct stage {
+  // NULL-terminated array of 'argc' words.
+  char **argv;
+  int argc;
+  struct redirection *redirections;
+  int nredirections;
+};
+
+
+// How a pipeline is joined to the one after it.
+enum connector {
+  CONNECT_END,       // the last pipeline
+  CONNECT_SEQUENCE,  // ;
+  CONNECT_AND,       // &&
+  CONNECT_OR,        // ||
+  CONNECT_BACKGROUND,  // &, the pipeline isn't waited for
+};
+
+
+// Stages connected by '|'.
+struct pipeline {
+  struct stage *stages;
+  int nstages;
+  enum connector connector;
+};
+
+
+// A command line, pipelines joined by ';', '&', '&&' or '||'.
+struct command_list {
+  struct pipeline *pipelines;
+  int npipelines;
+};
+
+
+//
+// Split a string 's' into pieces by any one of a set of separators.
+// Characters in 'special_chars' are returned as single words, or as
+// one of the operators '>>', '&&', '||', '<>', '>&', '<&', '&>',
+// '&>>', '<<', '<<-' and '<<<'. Digits right before a '<' or '>' at the start of a word are
+// part of the operator, as in '2>&1'.
+//
+// Returns an array of strings, with the last element being 'NULL';
+// The array itself, and the strings, are allocated from 'arena' and
+// are freed when it's reset.
+//
+char **tokenize(struct arena *arena, char *s, char *separators,
+                char *special_chars);
+
+
+// Parse the words of a command line into its pipelines, stages and
+// redirections in a single pass. Returns NULL and prints a message on
+// a syntax error. The plan is allocated from the command arena and
+// refers to the words in 'tokens'.
+struct command_list *parse_command(char **tokens);
+
+#endif
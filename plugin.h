@@ -0,0 +1,44 @@
+#ifndef SIMSH_PLUGIN_H
+#define SIMSH_PLUGIN_H
+
+//
+// The interface of builtins loaded from shared objects with
+// 'enable -f module.so name'. A module defines a 'struct
+// simsh_builtin' named '<name>_builtin' for every builtin it provides,
+// for example:
+//
+//     #include "plugin.h"
+//
+//     static int hello_main(int argc, char **argv, int in_fd, int out_fd,
+//                           int err_fd) {
+//       dprintf(out_fd, "hello, %s\n", argc > 1 ? argv[1] : "world");
+//       return 0;
+//     }
+//
+//     struct simsh_builtin hello_builtin = {
+//       SIMSH_PLUGIN_ABI_VERSION, "hello", "print a greeting",
+//       "hello [name]", hello_main,
+//     };
+//
+// built with 'gcc -shared -fPIC -o hello.so hello.c'. Only new fields
+// are ever added to the end of the struct, and the version is bumped
+// when they are.
+//
+
+#define SIMSH_PLUGIN_ABI_VERSION 1
+
+struct simsh_builtin {
+  // SIMSH_PLUGIN_ABI_VERSION of the header the module was built with.
+  int abi_version;
+  // the name the builtin is run by.
+  const char *name;
+  // a line each describing what it does and how it's run.
+  const char *description;
+  const char *usage;
+  // runs the builtin in the shell process, with its redirections
+  // already applied to 'in_fd', 'out_fd' and 'err_fd'. 'argv' has
+  // 'argc' words and ends with NULL. Returns the exit status.
+  int (*main)(int argc, char **argv, int in_fd, int out_fd, int err_fd);
+};
+
+#endif
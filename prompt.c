@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "prompt.h"
+
+#define MAX_NAME_CHARS 256
+
+
+static char username[MAX_NAME_CHARS];
+static char hostname[MAX_NAME_CHARS];
+static char homedir[PATH_MAX];
+static char cwd[PATH_MAX];
+
+// the prompt composed from the parts above, ready to be written.
+static char prompt[PATH_MAX + 4 * MAX_NAME_CHARS];
+static int prompt_len;
+
+
+static void update_homedir();
+static void compose_prompt();
+
+
+void init_prompt() {
+  if (getlogin_r(username, sizeof username) != 0) {
+    // no controlling terminal, fall back to the environment.
+    char *user = getenv("USER");
+    snprintf(username, sizeof username, "%s", user != NULL ? user : "");
+  }
+
+  if (gethostname(hostname, sizeof hostname) != 0) {
+    hostname[0] = '\0';
+  }
+  hostname[sizeof hostname - 1] = '\0';
+
+  update_homedir();
+  update_prompt_cwd();
+}
+
+
+void update_prompt_cwd() {
+  if (getcwd(cwd, sizeof cwd) == NULL) {
+    cwd[0] = '\0';
+  }
+  compose_prompt();
+}
+
+
+char *get_prompt() {
+  // the home directory can be changed by the environment at any time,
+  // only recompose the prompt when it does.
+  char *home = getenv("HOME");
+  if (strcmp(home != NULL ? home : "", homedir) != 0) {
+    update_homedir();
+    compose_prompt();
+  }
+  return prompt;
+}
+
+
+void print_prompt() {
+  get_prompt();
+
+  // anything still buffered must appear before the prompt.
+  fflush(stdout);
+  if (write(STDOUT_FILENO, prompt, prompt_len) == -1) {
+    perror("write");
+  }
+}
+
+
+static void update_homedir() {
+  char *home = getenv("HOME");
+  snprintf(homedir, sizeof homedir, "%s", home != NULL ? home : "");
+}
+
+
+static void compose_prompt() {
+  // abbreviate the home directory to '~', but only at a directory
+  // boundary so '/home/ab' isn't shortened when home is '/home/a'.
+  char *dir = cwd;
+  char *tilde = "";
+  int len = strlen(homedir);
+  if (len > 0 && strncmp(homedir, cwd, len) == 0 &&
+      (cwd[len] == '/' || cwd[len] == '\0')) {
+    tilde = "~";
+    dir = &cwd[len];
+  }
+
+  prompt_len = snprintf(prompt, sizeof prompt,
+                        GREEN "%s@%s" RESET ":" BLUE "%s%s" RESET "$ ",
+                        username, hostname, tilde, dir);
+  if (prompt_len >= (int)sizeof prompt) {
+    prompt_len = sizeof prompt - 1;
+  }
+}
@@ -0,0 +1,16 @@
+// Save the user name, host name, home directory and current directory
+// shown in the prompt.
+void init_prompt();
+
+
+// Refresh the current directory shown in the prompt, call this after
+// the current directory changes.
+void update_prompt_cwd();
+
+
+// Returns the prompt, composed again if what it shows has changed.
+char *get_prompt();
+
+
+// Prints the prompt with a single write.
+void print_prompt();
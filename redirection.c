@@ -1,346 +1,184 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <spawn.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <sys/wait.h>
+#include <unistd.h>
 
-#include "simsh.h"
-#include "helper.h"
+#include "heredoc.h"
+#include "trace.h"
 #include "redirection.h"
 
+// the lowest descriptor the descriptors of the shell are saved at.
+#define SAVED_FD_BASE 10
 
-int is_redirection(char **words) {
-  // return True if 'words' contains any '<' and '>'.
-  for (int i = 0; words[i] != NULL; i++) {
-    if (strcmp(words[i], ">") == 0 || strcmp(words[i], "<") == 0) {
-      return true;
-    }
-  }
-  return false;
-}
-
-
-int is_input_redirection(char **words) {
-  // return True if 'words' starts with '<'.
-  return strcmp(words[0], "<") == 0;
-}
-
-
-int is_output_write_redirection(char **words) {
-  int nwords = count_nwords(words);
-  // return True if 'words' contains '>' in the second last position.
-  return (nwords - 2 >= 0 && strcmp(words[nwords-2], ">") == 0) &&
-         (nwords - 3 >= 0 && strcmp(words[nwords-3], ">") != 0);
-}
-
-
-int is_output_append_redirection(char **words) {
-  int nwords = count_nwords(words);
-  // return True if 'words' contains two consecutive '>' in the second
-  // and third last position.
-  return (nwords - 2 >= 0 && strcmp(words[nwords-2], ">") == 0 &&
-          nwords - 3 >= 0 && strcmp(words[nwords-3], ">") == 0);
-}
-
-
-int is_valid_redirection_position(char **words) {
-  int nwords = count_nwords(words);
 
-  // if not enough words for input redirection
-  if (nwords - 3 < 0 && strcmp(words[0], "<") == 0) {
-    fprintf(stderr, "Invalid input redirection\n");
-    return false;
-  }
+static int get_highest_fd(struct redirection *redirections, int nredirections);
+static int get_source_fd(struct redirection *redirections, int n);
 
-  // if not enough words for output append redirection
-  if ((nwords - 3 >= 0 && strcmp(words[nwords-3], ">") == 0 &&
-      nwords - 2 >= 0 && strcmp(words[nwords-2], ">") == 0 &&
-      nwords - 4 < 0)) {
-    fprintf(stderr, "Invalid output redirection\n");
-    return false;
-  }
 
-  // if not enough words for output write redirection
-  if ((nwords - 1 >= 0 && strcmp(words[nwords-1], ">") == 0) ||
-      (nwords - 3 < 0 && strcmp(words[nwords-2], ">") == 0)) {
-    fprintf(stderr, "Invalid output redirection\n");
-    return false;
-  }
+int open_redirections(struct redirection *redirections, int nredirections,
+                      struct fd_action *actions, int *fds) {
+  // a file is kept above every descriptor the redirections name, or
+  // one applied before it could replace it.
+  int lowest_fd = get_highest_fd(redirections, nredirections) + 1;
+  uint64_t traced = (nredirections > 0) ? trace_begin() : 0;
 
-  // check if '<' or '>' appears in invalid position.
-  for (int i = 0; words[i] != NULL; i++) {
-    if (strcmp(words[i], "<") == 0 && i != 0) {
-      fprintf(stderr, "Invalid input redirection\n");
-      return false;
+  for (int i = 0; i < nredirections; i++) {
+    struct redirection *redirection = &redirections[i];
+    fds[i] = -1;
+    actions[i].target = redirection->fd;
 
-    } else if (strcmp(words[i], ">") == 0 && (i != nwords - 2 &&
-               i != nwords - 3)) {
-      // return False if the '>' appears in position other than
-      // second or third last position.
-      fprintf(stderr, "Invalid output redirection\n");
-      return false;
+    if (redirection->fd >= getdtablesize()) {
+      fprintf(stderr, "%d: %s\n", redirection->fd, strerror(EBADF));
+      close_redirection_fds(fds, i);
+      return -1;
     }
-  }
-  // return False if the third last word is '>' but the second last
-  // word is not '>'.
-  if ((nwords - 3 >= 0 && strcmp(words[nwords-3], ">") == 0 &&
-      nwords - 2 >= 0 && strcmp(words[nwords-2], ">") != 0)) {
-    fprintf(stderr, "Invalid output redirection\n");
-    return false;
-  }
-  return true;
-}
-
 
-int is_valid_redirection_program(char **words) {
-  int nwords = count_nwords(words);
-  // check input redirection: < file program
-  if (strcmp(words[0], "<") == 0 && is_builtin_command(words[2])) {
-    fprintf(stderr, "%s: I/O redirection not permitted for builtin commands\n", words[2]);
-    return false;
-  }
-
-  int pos = nwords - 1;
-  while (pos != 0) {
-    // stop at the position of the program, since
-    // command could be in the format: < file program
-    if (pos - 2 >= 0 && strcmp(words[pos-2], "<") == 0) {
+    int flags = O_RDONLY;
+    switch (redirection->type) {
+    case REDIRECT_INPUT:
+      flags = O_RDONLY;
+      break;
+    case REDIRECT_OUTPUT:
+      flags = O_CREAT|O_WRONLY|O_TRUNC;
       break;
+    case REDIRECT_APPEND:
+      flags = O_CREAT|O_WRONLY|O_APPEND;
+      break;
+    case REDIRECT_READ_WRITE:
+      flags = O_CREAT|O_RDWR;
+      break;
+    case REDIRECT_HERE_DOCUMENT:
+    case REDIRECT_HERE_DOCUMENT_INDENTED:
+    case REDIRECT_HERE_STRING:
+      flags = O_RDONLY;
+      break;
+    case REDIRECT_DUPLICATE:
+      actions[i].fd = get_source_fd(redirections, i);
+      if (actions[i].fd == -1) {
+        fprintf(stderr, "%s: %s\n", redirection->target, strerror(EBADF));
+        close_redirection_fds(fds, i);
+        return -1;
+      }
+      continue;
+    case REDIRECT_CLOSE:
+      actions[i].fd = -1;
+      continue;
     }
-    pos--;
-  }
-
-  // if pos = 0, then there's no '<' in 'words', also implies
-  // this function is used in a larger pipe command.
-  // else, pos = position of the program in 'words'.
-  if (is_builtin_command(words[pos])) {
-    fprintf(stderr, "%s: I/O redirection not permitted for builtin commands\n", words[pos]);
-    return false;
-  }
-  return true;
-}
-
-
-void input_redirection(char **tokens, char **path, char **environ) {
-
-  int fd = open(tokens[1], O_RDONLY);
-  if (fd == -1) {
-    perror(tokens[1]);
-    return;
-  }
-
-  posix_spawn_file_actions_t actions;
-  if (posix_spawn_file_actions_init(&actions) != 0) {
-    perror("posix_spawn_file_actions_init");
-    return;
-  }
-
-  // connect stdin of the program to the file.
-  if (posix_spawn_file_actions_adddup2(&actions, fd, 0) != 0) {
-    perror("posix_spawn_file_actions_adddup2");
-    return;
-  }
 
-  char executable_path[PATH_MAX];
-  if (executable_exists(path, tokens[2], executable_path)) {
-    pid_t pid;
-    if (posix_spawn(&pid, executable_path, &actions, NULL, &tokens[2],
-                    environ) != 0) {
-      fprintf(stderr, "%s: command not found\n", tokens[2]);
-
-      return;
+    // nothing but the program gets the file.
+    if (redirection->body != NULL) {
+      fds[i] = open_here_document(redirection->body);
+    } else {
+      fds[i] = open(redirection->target, flags|O_CLOEXEC, 0644);
     }
-
-    int status;
-    if (waitpid(pid, &status, 0) == -1) {
-      perror("waitpid");
-      return;
+    if (fds[i] != -1 && fds[i] < lowest_fd) {
+      int fd = fcntl(fds[i], F_DUPFD_CLOEXEC, lowest_fd);
+      close(fds[i]);
+      fds[i] = fd;
     }
-
-    if (WIFEXITED(status)) {
-      const int exit_status = WEXITSTATUS(status);
-      fprintf(stdout, "%s exit status = %d\n", executable_path, exit_status);
+    if (fds[i] == -1) {
+      perror(redirection->target);
+      close_redirection_fds(fds, i);
+      return -1;
     }
-  } else {
-      fprintf(stderr, "%s: command not found\n", tokens[2]);
-  }
-}
-
-
-void output_write_redirection(char **tokens, char **path, char **environ) {
-  int nwords = count_nwords(tokens);
-
-  int fd = open(tokens[nwords-1], O_CREAT|O_WRONLY|O_TRUNC, 0644);
-  if (fd == -1) {
-    perror(tokens[nwords-1]);
-    return;
-  }
-
-  posix_spawn_file_actions_t actions;
-  if (posix_spawn_file_actions_init(&actions) != 0) {
-    perror("posix_spawn_file_actions_init");
-    return;
-  }
 
-  // connect stdout to the file
-  if (posix_spawn_file_actions_adddup2(&actions, fd, 1) != 0) {
-    perror("posix_spawn_file_actions_adddup2");
-    return;
+    // connect the descriptor of the program to the file.
+    actions[i].fd = fds[i];
   }
-  char executable_path[PATH_MAX];
-
-  if (executable_exists(path, tokens[0], executable_path)) {
-    pid_t pid;
-    char **args = get_args_for_output_redirection(tokens);
-
-    if (posix_spawn(&pid, executable_path, &actions, NULL, args, environ) != 0) {
-      fprintf(stderr, "%s: command not found\n", args[0]);
-      return;
-    }
+  trace_end("open-redirections", traced,
+            (nredirections > 0) ? redirections[0].target : NULL);
+  return 0;
+}
 
-    int status;
-    if (waitpid(pid, &status, 0) == -1) {
-      perror("waitpid");
-      return;
-    }
 
-    if (WIFEXITED(status)) {
-      const int exit_status = WEXITSTATUS(status);
-      fprintf(stdout, "%s exit status = %d\n", executable_path, exit_status);
+void close_redirection_fds(int *fds, int nfds) {
+  for (int i = 0; i < nfds; i++) {
+    if (fds[i] != -1) {
+      close(fds[i]);
     }
-  } else {
-      fprintf(stderr, "%s: command not found\n", tokens[0]);
   }
 }
 
 
-void output_append_redirection(char **tokens, char **path, char **environ) {
-  int nwords = count_nwords(tokens);
-  int fd = open(tokens[nwords-1], O_CREAT|O_WRONLY|O_APPEND, 0644);
-  if (fd == -1) {
-    perror(tokens[nwords-1]);
-    return;
-  }
-
-  posix_spawn_file_actions_t actions;
-  if (posix_spawn_file_actions_init(&actions) != 0) {
-    perror("posix_spawn_file_actions_init");
-    return;
-  }
-
-  // connect stdout to the file
-  if (posix_spawn_file_actions_adddup2(&actions, fd, 1) != 0) {
-    perror("posix_spawn_file_actions_adddup2");
-    return;
-  }
-
-  char executable_path[PATH_MAX];
-  if (executable_exists(path, tokens[0], executable_path)) {
-    pid_t pid;
-    char **args = get_args_for_output_redirection(tokens);
-
-    if (posix_spawn(&pid, executable_path, &actions, NULL, args, environ) != 0) {
-      fprintf(stderr, "%s: command not found\n", args[0]);
-      return;
+int swap_fds(struct fd_action *actions, int nactions, int *saved) {
+  uint64_t traced = (nactions > 0) ? trace_begin() : 0;
+  // saved above every target, which the actions may replace.
+  int lowest_fd = SAVED_FD_BASE;
+  for (int i = 0; i < nactions; i++) {
+    if (actions[i].target >= lowest_fd) {
+      lowest_fd = actions[i].target + 1;
     }
+  }
 
-    int status;
-    if (waitpid(pid, &status, 0) == -1) {
-      perror("waitpid");
-      return;
-    }
+  for (int i = 0; i < nactions; i++) {
+    int target = actions[i].target;
+    // -1 if the target wasn't open.
+    saved[i] = fcntl(target, F_DUPFD_CLOEXEC, lowest_fd);
 
-    if (WIFEXITED(status)) {
-      const int exit_status = WEXITSTATUS(status);
-      fprintf(stdout, "%s exit status = %d\n", executable_path, exit_status);
+    int result = (actions[i].fd == -1) ? close(target)
+                                       : dup2(actions[i].fd, target);
+    if (result == -1 && actions[i].fd != -1) {
+      perror("dup2");
+      restore_fds(actions, i + 1, saved);
+      return -1;
     }
-  } else {
-      fprintf(stderr, "%s: command not found\n", tokens[0]);
   }
+  trace_end("swap-fds", traced, NULL);
+  return 0;
 }
 
 
-void input_output_redirection(char **tokens, char **path, char **environ) {
-  
-  int input_fd = open(tokens[1], O_RDONLY);
-  if (input_fd == -1) {
-    perror(tokens[1]);
-    return;
-  }
-
-  int output_fd = -1;
-  int nwords = count_nwords(tokens);
-  if (is_output_write_redirection(tokens)) {
-    output_fd = open(tokens[nwords-1], O_CREAT|O_WRONLY|O_TRUNC, 0644);
-
-  } else if (is_output_append_redirection(tokens)) {
-    output_fd = open(tokens[nwords-1], O_CREAT|O_WRONLY|O_APPEND, 0644);
-
-  }
-
-  posix_spawn_file_actions_t actions;
-  if (posix_spawn_file_actions_init(&actions) != 0) {
-    perror("posix_spawn_file_actions_init");
-    return;
-  }
-
-  // connect stdin to the file
-  if (posix_spawn_file_actions_adddup2(&actions, input_fd, 0) != 0) {
-    perror("posix_spawn_file_actions_adddup2");
-    return;
-  }
-
-  // connect stdout to the file
-  if (posix_spawn_file_actions_adddup2(&actions, output_fd, 1) != 0) {
-    perror("posix_spawn_file_actions_adddup2");
-    return;
+void restore_fds(struct fd_action *actions, int nactions, int *saved) {
+  // in reverse, a descriptor redirected twice gets its first value back.
+  for (int i = nactions - 1; i >= 0; i--) {
+    if (saved[i] != -1) {
+      dup2(saved[i], actions[i].target);
+      close(saved[i]);
+    } else {
+      close(actions[i].target);
+    }
   }
+}
 
-  char executable_path[PATH_MAX];
-  if (executable_exists(path, tokens[2], executable_path)) {
-    pid_t pid;
-    char **args = get_args_for_output_redirection(tokens);
-    if (posix_spawn(&pid, executable_path, &actions, NULL, args, environ) != 0) {
-      fprintf(stderr, "%s: command not found\n", args[0]);
-      return;
-    }
 
-    int status;
-    if (waitpid(pid, &status, 0) == -1) {
-      perror("waitpid");
-      return;
+// Returns the highest descriptor redirected or copied by 'redirections'.
+static int get_highest_fd(struct redirection *redirections, int nredirections) {
+  int highest = STDERR_FILENO;
+  for (int i = 0; i < nredirections; i++) {
+    if (redirections[i].fd > highest) {
+      highest = redirections[i].fd;
     }
-
-    if (WIFEXITED(status)) {
-      const int exit_status = WEXITSTATUS(status);
-      fprintf(stdout, "%s exit status = %d\n", executable_path, exit_status);
+    long source = (redirections[i].type == REDIRECT_DUPLICATE) ?
+                  strtol(redirections[i].target, NULL, 10) : 0;
+    if (source > highest && source < INT_MAX) {
+      highest = source;
     }
-  } else {
-      fprintf(stderr, "%s: command not found\n", tokens[0]);
   }
+  return highest;
 }
 
 
-char **get_args_for_output_redirection(char **tokens) {
-  int ntokens = count_nwords(tokens);
-  char **args = malloc(sizeof(char *) * ntokens);
-  int count = 0;
-  // copy all words before '>'
-  while (count < ntokens && strcmp(tokens[count], ">") != 0) {
-    args[count] = tokens[count];
-    count++;
+// Returns the descriptor copied by redirection 'n', or -1 if it isn't
+// open for the program: it must have been opened by one of the
+// redirections before it, or be one the shell was given, since the
+// shell's own are close-on-exec.
+static int get_source_fd(struct redirection *redirections, int n) {
+  long source = strtol(redirections[n].target, NULL, 10);
+  if (source >= getdtablesize()) {
+    return -1;
   }
-  // allocates enough space for placing NULL
-  args = realloc(args, sizeof(char *) * (count + 1));
-  args[count] = NULL;
 
-  // handle the case when input redirection is next to output redirection.
-  // e.g. args => < pwd cat > cd
-  if (strcmp(args[0], "<") == 0) {
-    args = &args[2];
+  for (int i = n - 1; i >= 0; i--) {
+    if (redirections[i].fd == source) {
+      return (redirections[i].type == REDIRECT_CLOSE) ? -1 : source;
+    }
   }
-  return args;
+  int flags = fcntl(source, F_GETFD);
+  return (flags == -1 || (flags & FD_CLOEXEC)) ? -1 : source;
 }
@@ -1,52 +1,25 @@
-// return True if 'words' contains '<' or '>'.
-int is_redirection(char **words);
+#include "parser.h"
+#include "execcache.h"
 
+// Open the files of 'redirections' and save the actions connecting
+// them to the descriptors they redirect, in order, into 'actions'.
+// The opened descriptors are saved in 'fds', both have room for
+// 'nredirections' entries. Returns -1 and prints a message if a file
+// can't be opened, no descriptors are left open then.
+int open_redirections(struct redirection *redirections, int nredirections,
+                      struct fd_action *actions, int *fds);
 
-// check if the command is an input redirection
-int is_input_redirection(char **words);
 
+// Close the descriptors opened by 'open_redirections', once the
+// program they're for has been spawned.
+void close_redirection_fds(int *fds, int nfds);
 
-// check if the command is an output redirection in write mode
-int is_output_write_redirection(char **words);
 
+// Apply 'actions' to the shell itself, for a builtin. The descriptors
+// they replace are saved into 'saved', which has room for 'nactions'
+// entries. Returns -1 and restores them if one can't be applied.
+int swap_fds(struct fd_action *actions, int nactions, int *saved);
 
-// check if the command is an output redirection in append mode
-// return True if 'words' contains two consecutive '>'.
-int is_output_append_redirection(char **words);
 
-
-// return True if '<' and '>' appears in the valid position.
-// '<' must be the first word, while '>' can appear in the
-// second or third last word.
-// if '>' appears in the third last word than '>' must also
-// appears in the second last word.
-int is_valid_redirection_position(char **words);
-
-
-// return True if the command involved in redirection is not
-// a builtin command.
-int is_valid_redirection_program(char **words);
-
-
-// this function is used if the command contains only input redirection.
-void input_redirection(char **tokens, char **path, char **environ);
-
-
-// this function is used if the command contains only output redirection
-// in write mode.
-void output_write_redirection(char **tokens, char **path, char **environ);
-
-
-// this function is used if the command contains only output redirection
-// in append mode.
-void output_append_redirection(char **tokens, char **path, char **environ);
-
-
-// this function is used if the command contains one input redirection
-// and one output redirection.
-void input_output_redirection(char **tokens, char **path, char **environ);
-
-
-// this function is used to return the arguments array for an output
-// redirection command.
-char **get_args_for_output_redirection(char **tokens);
+// Undo 'swap_fds', putting the saved descriptors back in place.
+void restore_fds(struct fd_action *actions, int nactions, int *saved);
@@ -3,25 +3,26 @@
  * Description: A simple Unix shell based on BASH
  */
 
-#define MAX_LINE_CHARS 1024
+#define _GNU_SOURCE
+
 #define INTERACTIVE_PROMPT "cowrie> "
 #define DEFAULT_PATH "/bin:/usr/bin"
 #define WORD_SEPARATORS " \t\r\n"
 #define DEFAULT_HISTORY_SHOWN 10
+#define INPUT_BUFFER_SIZE 65536
 
-// These characters are always returned as single words
-#define SPECIAL_CHARS "!><|"
+// These characters are always returned as single words or operators
+#define SPECIAL_CHARS "!><|;&"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <spawn.h>
 #include <unistd.h>
 #include <limits.h>
-#include <glob.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -30,26 +31,128 @@
 #include "history.h"
 #include "redirection.h"
 #include "color.h"
-
-static void print_prompt();
-static void execute_command(char **words, char **path, char **environment);
+#include "hash.h"
+#include "prompt.h"
+#include "arena.h"
+#include "parser.h"
+#include "execcache.h"
+#include "globbing.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "builtin.h"
+#include "heredoc.h"
+#include "metrics.h"
+#include "trace.h"
+#include "lineedit.h"
+#include "complete.h"
+#include "simsh.h"
+
+static int execute_command(char **words, char **path, char **environment,
+                           FILE *input);
+static int execute_pipeline(struct pipeline *pipeline, char **path,
+                            char **environment);
+static int time_pipeline(struct pipeline *pipeline, char **path,
+                         char **environment);
+static int execute_stage(struct stage *stage, char **path, char **environment,
+                         bool background);
 static void do_exit(char **words);
-static char **globbing(char **tokens);
-static char **glob_word(char **globbed_command, int *ntokens, char *token);
-static void piping(char **tokens, char **path, char **environ);
+static void do_hash(char **words, char **path);
+static int do_set(char **words);
+static int piping(struct pipeline *pipeline, char **path, char **environ,
+                  bool background);
 static char *get_single_string(char **tokens);
 static void construct_absolute_path(char *path, char *program, char *executable_path);
 static int is_executable(char *pathname);
-static int execute_executable(char **command_argv, char *path, char **environ);
-static void print_and_execute_past_command(char *asciiNumber, char **path, char **environment);
-static char **tokenize(char *s, char *separators, char *special_chars);
-static void free_tokens(char **tokens);
+static int find_program(char **path, char *program, char *executable_path);
+static int execute_executable(char **command_argv, char *path,
+                              struct builtin *builtin, struct stage *stage,
+                              char **environ, bool background);
+static pid_t spawn_program(char **command_argv, char *path,
+                           struct builtin *builtin, struct stage *stage,
+                           int input_fd, int output_fd,
+                           struct spawn_group *group, char **environ);
+static void record_pipe_status(int *statuses, int nstatuses);
+static void print_pipe_status();
+static int print_and_execute_past_command(char *asciiNumber, char **path, char **environment);
+
+static void usage();
+
+// print the exit status of every program that finishes.
+bool show_exit_status = false;
+
+// options of the shell, changed by the 'set' builtin.
+static struct {
+  char *name;
+  bool *value;
+} options[] = {
+  { "nosort", &glob_nosort },
+  { "trace-perf", &trace_perf },
+  { NULL, NULL },
+};
+
+// exit status of every stage of the last pipeline.
+static int *pipe_status;
+static int npipe_status;
+static int pipe_status_size;
+
+
+int main(int argc, char *argv[]) {
+  extern char **environ;
 
-int executable_exists(char **path, char *program, char *executable_path);
+  char *command_string = NULL;
+  bool interactive = false;
 
+  int opt;
+  while ((opt = getopt(argc, argv, "+c:iv")) != -1) {
+    switch (opt) {
+    case 'c':
+      command_string = optarg;
+      break;
+    case 'i':
+      interactive = true;
+      break;
+    case 'v':
+      show_exit_status = true;
+      break;
+    default:
+      usage();
+      return 2;
+    }
+  }
 
-int main(void) {
-  extern char **environ;
+  // commands come from the '-c' string, a script file or stdin,
+  // only a terminal on stdin makes the shell interactive.
+  FILE *input;
+  if (command_string != NULL) {
+    input = fmemopen(command_string, strlen(command_string), "r");
+    if (input == NULL) {
+      perror("fmemopen");
+      return 2;
+    }
+  } else if (optind < argc) {
+    input = fopen(argv[optind], "re");
+    if (input == NULL) {
+      perror(argv[optind]);
+      return 127;
+    }
+  } else {
+    input = stdin;
+    if (isatty(STDIN_FILENO)) {
+      interactive = true;
+    }
+  }
+
+  init_jobs(interactive);
+  init_metrics();
+  init_trace();
+  if (interactive) {
+    show_exit_status = true;
+    init_prompt();
+  } else {
+    // batch input is read in large blocks and isn't kept in history.
+    setvbuf(input, NULL, _IOFBF, INPUT_BUFFER_SIZE);
+    disable_history();
+  }
 
   // grab the 'PATH' environment variable;
   // if it isn't set, use the default path defined above
@@ -57,139 +160,283 @@ int main(void) {
   if ((pathp = getenv("PATH")) == NULL) {
     pathp = DEFAULT_PATH;
   }
-  char **path = tokenize(pathp, ":", "");
+  // the path outlives every command, it has an arena of its own.
+  struct arena path_arena = { NULL };
+  pathp = arena_strdup(&path_arena, pathp);
+  char **path = tokenize(&path_arena, pathp, ":", "");
+  set_completion_path(path);
+
+  // the line buffer is reused for every line and grows to fit the
+  // longest one read so far.
+  char *line = NULL;
+  size_t line_size = 0;
 
   // main loop: print prompt, read line, execute command
+  int status = 0;
   while (1) {
-    print_prompt();
+    // re-split the path if 'PATH' changed since the last command,
+    // the hashed locations are dropped along with the old path.
+    char *new_pathp = getenv("PATH");
+    if (new_pathp == NULL) {
+      new_pathp = DEFAULT_PATH;
+    }
+    if (strcmp(new_pathp, pathp) != 0) {
+      arena_reset(&path_arena);
+      pathp = arena_strdup(&path_arena, new_pathp);
+      path = tokenize(&path_arena, pathp, ":", "");
+      hash_clear();
+      set_completion_path(path);
+    }
 
-    char line[MAX_LINE_CHARS];
-    if (fgets(line, MAX_LINE_CHARS, stdin) == NULL) {
+    // finished background jobs are reported before the prompt.
+    notify_jobs();
+    // a terminal on stdin is read through the line editor, which
+    // prints the prompt itself.
+    ssize_t len;
+    if (interactive && input == stdin) {
+      flush_history();
+      len = edit_line(get_prompt(), &line, &line_size);
+    } else {
+      if (interactive) {
+        flush_history();
+        print_prompt();
+      }
+      len = getline(&line, &line_size, input);
+    }
+    if (len == -1) {
       break;
     }
 
-    char **command_words = tokenize(line, WORD_SEPARATORS, SPECIAL_CHARS);
-    execute_command(command_words, path, environ);
-    free_tokens(command_words);
+    // skip comments, including the '#!' line of a script.
+    if (line[strspn(line, WORD_SEPARATORS)] == '#') {
+      continue;
+    }
+
+    // the time spent on a line which ran no job isn't counted.
+    uint64_t phases[NPHASES];
+    take_phase_times(phases);
+    uint64_t started = metrics_clock();
+    uint64_t traced = trace_begin();
+
+    // everything the command line needs is allocated from the
+    // command arena and freed at once when it finishes.
+    char **command_words = tokenize(&command_arena, line, WORD_SEPARATORS,
+                                    SPECIAL_CHARS);
+    add_phase_time(PHASE_PARSE, started);
+    trace_end("tokenize", traced, NULL);
+    status = execute_command(command_words, path, environ, input);
+    arena_reset(&command_arena);
+
+    // keep the output of builtins in order with the output of the
+    // programs run by the next command.
+    fflush(stdout);
   }
 
-  free_tokens(path);
-  return 0;
+  free(line);
+  if (input != stdin) {
+    fclose(input);
+  }
+
+  arena_reset(&path_arena);
+  return status;
 }
 
 
+// Programs are looked up in the hash table first, the path is only
+// searched on a miss and the result is hashed for the next lookup.
 int executable_exists(char **path, char *program, char *executable_path) {
+  switch (hash_lookup(path, program, executable_path)) {
+  case HASH_FOUND:
+    return true;
+  case HASH_NOT_FOUND:
+    return false;
+  }
+
   for (int i = 0; path[i] != NULL; i++) {
     construct_absolute_path(path[i], program, executable_path);
     if (is_executable(executable_path)) {
+      hash_insert(path, program, executable_path, i);
+      // the descriptor kept for this path may be of a replaced file.
+      exec_cache_remove(executable_path);
       return true;
     }
   }
+  hash_insert_not_found(path, program);
   return false;
 }
 
-static void print_prompt() {
-  char prompt[MAX_LINE_CHARS];
-
-  char username[MAX_LINE_CHARS];
-  getlogin_r(username, MAX_LINE_CHARS);
-
-  char pathname[MAX_LINE_CHARS];
-  getcwd(pathname, sizeof pathname);
-
-  char hostname[MAX_LINE_CHARS];
-  gethostname(hostname, MAX_LINE_CHARS);
+static void usage() {
+  fprintf(stderr, "usage: simsh [-iv] [-c command | script]\n");
+}
 
-  green();
-  fprintf(stdout, "%s@%s", username, hostname);
-  reset();
-  fprintf(stdout, ":");
 
-  char *homedir = getenv("HOME");
-  int len = strlen(homedir);
-  if (startsWith(homedir, pathname) == true) {
-    snprintf(pathname, sizeof pathname, "%s%s", "~", &pathname[len]);
+int report_exit_status(char *path, int status) {
+  if (WIFEXITED(status)) {
+    if (show_exit_status) {
+      fprintf(stdout, "%s exit status = %d\n", path, WEXITSTATUS(status));
+    }
+    return WEXITSTATUS(status);
   }
-
-  blue();
-  fprintf(stdout, "%s", pathname);
-  reset();
-  fprintf(stdout, "$ ");
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
 }
 
 
 //
 // Execute a command, and wait until it finishes.
+// Returns the exit status of the last pipeline that was run.
 //
 // 'words': a NULL-terminated array of words from the input command line
 // 'path': a NULL-terminated array of directories to search in;
 // 'environment': a NULL-terminated array of environment variables.
+// 'input': where the bodies of its here-documents are read from, NULL
+// if there's none.
 //
-static void execute_command(char **words, char **path, char **environment) {
+static int execute_command(char **words, char **path, char **environment,
+                           FILE *input) {
   assert(words != NULL);
   assert(path != NULL);
   assert(environment != NULL);
 
-  char *home_path = getenv("HOME");
+  uint64_t command_traced = trace_begin();
+  uint64_t started = metrics_clock();
+  uint64_t traced = trace_begin();
+  struct command_list *list = parse_command(words);
+  add_phase_time(PHASE_PARSE, started);
+  trace_end("parse", traced, NULL);
+  if (list == NULL) {
+    write_to_history(words);
+    return 2;
+  }
+  traced = trace_begin();
+  read_here_documents(list, input, input == stdin && isatty(STDIN_FILENO));
+  trace_end("here-documents", traced, NULL);
+
+  int status = 0;
+  for (int i = 0; i < list->npipelines; i++) {
+    // '&&' and '||' skip a pipeline depending on the last exit status.
+    if (i > 0) {
+      enum connector connector = list->pipelines[i-1].connector;
+      if ((connector == CONNECT_AND && status != 0) ||
+          (connector == CONNECT_OR && status == 0)) {
+        continue;
+      }
+    }
+    status = execute_pipeline(&list->pipelines[i], path, environment);
+  }
 
-  char **globbed_words = globbing(words);
+  // the command replayed by '!' is saved instead of '!' itself.
+  if (list->npipelines > 0 && (list->npipelines > 1 ||
+      list->pipelines[0].nstages > 1 || strcmp(words[0], "!") != 0)) {
+    write_to_history(words);
+  }
+  if (command_traced != 0 && words[0] != NULL) {
+    trace_end("command", command_traced, get_single_string(words));
+  }
+  return status;
+}
 
-  // name of the program
-  char *program = globbed_words[0];
 
-  if (program == NULL) {
-    // nothing to do
-    return;
+// Run a pipeline, in the background if it's followed by '&', which
+// has an exit status of 0.
+static int execute_pipeline(struct pipeline *pipeline, char **path,
+                            char **environment) {
+  bool background = (pipeline->connector == CONNECT_BACKGROUND);
+  struct stage *first = &pipeline->stages[0];
+  if (first->argc > 0 && strcmp(first->argv[0], "time") == 0) {
+    return time_pipeline(pipeline, path, environment);
+  }
+  if (pipeline->nstages > 1) {
+    return piping(pipeline, path, environment, background);
+  }
+  int status = execute_stage(&pipeline->stages[0], path, environment,
+                             background);
+  record_pipe_status(&status, 1);
+  return status;
+}
 
-  } else if (strcmp(program, "exit") == 0) {
-    do_exit(globbed_words);
 
-  } else if (is_pipes(globbed_words)) {
-    // any command contains '|' get caught here
-    piping(globbed_words, path, environment);
+//
+// Implement the 'time' shell built-in, which runs the rest of the
+// pipeline and prints the time it took and the CPU time used by the
+// shell and its programs to stderr.
+//
+// Synopsis: time [-p] [pipeline]
+// Examples:
+//     % time make
+//     % time -p sort big.txt | uniq -c
+//
+static int time_pipeline(struct pipeline *pipeline, char **path,
+                         char **environment) {
+  struct stage *first = &pipeline->stages[0];
+  char **argv = first->argv;
+  int argc = first->argc;
+
+  bool posix = (argv[1] != NULL && strcmp(argv[1], "-p") == 0);
+  first->argv += posix ? 2 : 1;
+  first->argc -= posix ? 2 : 1;
+
+  struct timing timing;
+  start_timing(&timing);
+  int status = 0;
+  if (first->argc > 0 || pipeline->nstages > 1) {
+    status = execute_pipeline(pipeline, path, environment);
+  }
+  print_timing(&timing, posix);
+
+  first->argv = argv;
+  first->argc = argc;
+  return status;
+}
 
-  } else if (is_redirection(globbed_words)) {
-    if (!is_valid_redirection_position(globbed_words)) {
-      write_to_history(globbed_words);
-      return;
 
-    } else if (!is_valid_redirection_program(globbed_words)) {
-      write_to_history(globbed_words);
-      return;
-    }
+// Execute a single command with its redirections, which is either a
+// builtin command or a program. Builtins of the shell always run in the
+// shell, even in the background; its small utilities run in a child of
+// their own in the background, as a job.
+static int execute_stage(struct stage *stage, char **path, char **environment,
+                         bool background) {
+  if (stage->argc == 0) {
+    fprintf(stderr, "Invalid null command\n");
+    return 1;
+  }
 
-    if (is_input_redirection(globbed_words) && (is_output_write_redirection(globbed_words)
-        || is_output_append_redirection(globbed_words))) {
-      input_output_redirection(globbed_words, path, environment);
+  char *home_path = getenv("HOME");
 
-    } else if (is_input_redirection(globbed_words)) {
-      input_redirection(globbed_words, path, environment);
+  char **words = stage->argv;
+  uint64_t started = metrics_clock();
+  uint64_t traced = trace_begin();
+  char **globbed_words = globbing(words);
+  add_phase_time(PHASE_GLOB, started);
+  trace_end("glob", traced, words[0]);
 
-    } else if (is_output_write_redirection(globbed_words)) {
-      output_write_redirection(globbed_words, path, environment);
+  // name of the program
+  char *program = globbed_words[0];
 
-    } else if (is_output_append_redirection(globbed_words)) {
-      output_append_redirection(globbed_words, path, environment);
+  if (strcmp(program, "exit") == 0) {
+    do_exit(globbed_words);
 
-    }
+  } else if (is_builtin_command(program) && stage->nredirections > 0) {
+    fprintf(stderr, "%s: I/O redirection not permitted for builtin commands\n",
+            program);
+    return 1;
 
   } else if (strcmp(program, "cd") == 0) {
     if (count_nwords(globbed_words) > 2) {
       print_too_many_arguments(program);
-      write_to_history(globbed_words);
-      return;
+      return 1;
     }
 
-    if (globbed_words[1] != NULL) {
-     
-      if (chdir(globbed_words[1]) == -1) {
-        fprintf(stderr, "cd: %s: ", globbed_words[1]);
-        perror("");
-      }
+    char *dir = globbed_words[1] != NULL ? globbed_words[1] : home_path;
+    if (dir == NULL) {
+      fprintf(stderr, "cd: HOME not set\n");
+      return 1;
 
-    } else {
-      chdir(home_path);
+    } else if (chdir(dir) == -1) {
+      fprintf(stderr, "cd: %s: ", dir);
+      perror("");
+      return 1;
     }
+    update_prompt_cwd();
 
   } else if (strcmp(program, "pwd") == 0) {
 
@@ -199,54 +446,95 @@ static void execute_command(char **words, char **path, char **environment) {
 
   } else if (strcmp(program, "history") == 0) {
 
+    // search with the words as typed, they aren't globbed.
+    if (words[1] != NULL && (strcmp(words[1], "-s") == 0 ||
+                             strcmp(words[1], "-p") == 0)) {
+      if (words[2] == NULL) {
+        fprintf(stderr, "history: %s: option requires an argument\n",
+                words[1]);
+        return 1;
+      }
+      char *pattern = get_single_string(&words[2]);
+      search_history(pattern, strcmp(words[1], "-p") == 0);
+      return 0;
+    }
+
     if (count_nwords(globbed_words) > 2) {
       print_too_many_arguments(program);
-      write_to_history(globbed_words);
-      return;
+      return 1;
     }
 
     // ensure if 1st arg exists it's an integer
     if (globbed_words[1] != NULL && !is_integer(globbed_words[1])) {
       fprintf(stderr, "history: %s: numeric argument required\n",
 	      words[1]);
-      write_to_history(words);
-      return;
+      return 1;
     }
 
     print_history(globbed_words[1]);
-    
-  } else if (strcmp(program, "!") == 0) {
-    if (globbed_words[1] != NULL && !is_integer(globbed_words[1])) {
-      fprintf(stderr, "!: %s: numeric argument required\n",
-              words[1]);
-      return;
-    }
 
-    print_and_execute_past_command(globbed_words[1], path, environment);
+  } else if (strcmp(program, "hash") == 0) {
+    do_hash(globbed_words, path);
 
-    return;
+  } else if (strcmp(program, "pipestatus") == 0) {
+    print_pipe_status();
 
-  } else if (strchr(program, '/') == NULL) {
-    char executable_path[PATH_MAX];
+  } else if (strcmp(program, "set") == 0) {
+    return do_set(globbed_words);
 
-    if (executable_exists(path, program, executable_path)) {
-      execute_executable(globbed_words, executable_path, environment);
+  } else if (strcmp(program, "jobs") == 0) {
+    return do_jobs(globbed_words);
 
-    } else {
-      fprintf(stderr, "%s: command not found\n", program);
+  } else if (strcmp(program, "fg") == 0) {
+    return do_fg(globbed_words);
+
+  } else if (strcmp(program, "bg") == 0) {
+    return do_bg(globbed_words);
+
+  } else if (strcmp(program, "wait") == 0) {
+    return do_wait(globbed_words);
 
+  } else if (strcmp(program, "parallel") == 0) {
+    return do_parallel(globbed_words, path, environment);
+
+  } else if (strcmp(program, "!") == 0) {
+    if (globbed_words[1] != NULL && !is_integer(globbed_words[1])) {
+      fprintf(stderr, "!: %s: numeric argument required\n",
+              words[1]);
+      return 1;
     }
 
-  } else if (is_executable(program)) {
-    execute_executable(globbed_words, program, environment);
+    return print_and_execute_past_command(globbed_words[1], path, environment);
+
+  } else if (find_builtin(globbed_words) != NULL && background) {
+    return execute_executable(globbed_words, program,
+                              find_builtin(globbed_words), stage, environment,
+                              background);
+
+  } else if (find_builtin(globbed_words) != NULL) {
+    // small utilities run in the shell, without a fork and exec.
+    traced = trace_begin();
+    int status = run_builtin(find_builtin(globbed_words), globbed_words,
+                             stage);
+    trace_end("builtin", traced, program);
+    return status;
 
   } else {
-    fprintf(stderr, "%s: command not found\n", program);
+    char executable_path[PATH_MAX];
 
+    started = metrics_clock();
+    traced = trace_begin();
+    bool found = find_program(path, program, executable_path);
+    add_phase_time(PHASE_LOOKUP, started);
+    trace_end("lookup", traced, program);
+    if (!found) {
+      return 127;
+    }
+    return execute_executable(globbed_words, executable_path, NULL, stage,
+                              environment, background);
   }
 
-  write_to_history(words);
-  return;
+  return 0;
 }
 
 
@@ -277,258 +565,203 @@ static void do_exit(char **words) {
 }
 
 
-// Returns an array of strings, with the last element being 'NULL'.
-// 'tokens' is the output of the 'tokenize' function.
-// Replace characters '*', '?', '[', or '~' appears in a word by
-// all of the words matching that word.
-// If there are no matches, use the word unchanged.
-static char **globbing(char **tokens) {
-  char **globbed_tokens = malloc(sizeof(*tokens));
-
-  // save the program's name.
-  globbed_tokens[0] = tokens[0];
-  int ntokens = 1;
-
-  if (tokens[0] == NULL) return globbed_tokens;
-  // iterate through all tokens, glob each of them and append matching
-  // words to the end of the array.
-  for (int i = 1; tokens[i] != NULL; i++) {
-    globbed_tokens = glob_word(globbed_tokens, &ntokens, tokens[i]);
-  }
-
-  globbed_tokens = realloc(globbed_tokens, sizeof(*globbed_tokens) *
-                           (ntokens + 1));
-  globbed_tokens[ntokens] = NULL;
-  return globbed_tokens;
-}
-
-
-// Glob a word and append it to the end of an array of strings.
-static char **glob_word(char **globbed_tokens, int *ntokens, char *token) {
-  glob_t matches;
-  int result = glob(token, GLOB_NOCHECK|GLOB_TILDE, NULL, &matches);
-
-  if (result != 0) {
-    // no matches, add back the original token.
-    (*ntokens)++;
-    globbed_tokens = realloc(globbed_tokens, sizeof(*globbed_tokens) *
-                             (*ntokens));
-
-    globbed_tokens[(*ntokens)-1] = token;
-  } else {
-    // has matches, append all matches to the array.
-    globbed_tokens = realloc(globbed_tokens, sizeof(*globbed_tokens) *
-                             ((*ntokens) + matches.gl_pathc));
-
-    for (int i = 0; i < matches.gl_pathc; i++) {
-      globbed_tokens[(*ntokens)] = matches.gl_pathv[i];
-      (*ntokens)++;
+//
+// Implement the 'set' shell built-in, which turns options of the shell
+// on with '-o' and off with '+o', or lists them.
+//
+// Synopsis: set [-o|+o option...]
+// Examples:
+//     % set -o
+//     % set -o nosort
+//     % set +o nosort
+//
+static int do_set(char **words) {
+  if (words[1] == NULL || (strcmp(words[1], "-o") == 0 && words[2] == NULL)) {
+    for (int i = 0; options[i].name != NULL; i++) {
+      printf("%-15s %s\n", options[i].name, *options[i].value ? "on" : "off");
     }
+    return 0;
   }
-  return globbed_tokens;
-}
 
+  if (strcmp(words[1], "-o") != 0 && strcmp(words[1], "+o") != 0) {
+    fprintf(stderr, "set: %s: invalid option\n", words[1]);
+    return 2;
+  }
 
-// handle any command contains at least one '|' in it.
-static void piping(char **tokens, char **path, char **environ) {
-  char *command = get_single_string(tokens);
-  char **commands = tokenize(command, "|", "");
-
-  int prev_read_pipe = -1;
-  int i = 0;
-  while (commands[i+1] != NULL) {
-
-    char **components = tokenize(commands[i], WORD_SEPARATORS, SPECIAL_CHARS);
-
-    int pipe_fds[2];
-    if (pipe(pipe_fds) == -1) {
-      perror("pipe");
-      return;
-    }
-
-    posix_spawn_file_actions_t actions;
-    if (posix_spawn_file_actions_init(&actions) != 0) {
-      perror("posix_spawn_file_actions_init");
-      return;
-    }
-
-    // connect child process stdout to the write side of the child process pipe.
-    if (posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], 1)) {
-      perror("posix_spawn_file_actions_adddup2");
+  bool value = (words[1][0] == '-');
+  int status = 0;
+  for (int i = 2; words[i] != NULL; i++) {
+    int j = 0;
+    while (options[j].name != NULL && strcmp(options[j].name, words[i]) != 0) {
+      j++;
     }
 
-    if (prev_read_pipe != -1) {
-
-
-      // connect the stdin of the child process to the read side of the previous process's pipe
-      if(posix_spawn_file_actions_adddup2(&actions, prev_read_pipe, 0) != 0)
-      {
-        perror("posix_spawn_file_actions_adddup2");
-        return;
-      }
-
-      char executable_path[PATH_MAX];
-      executable_exists(path, components[0], executable_path);
-
-      pid_t pid;
-      if (posix_spawn(&pid, executable_path, &actions, NULL, components, environ)) {
-        fprintf(stderr, "%s: command not found\n", components[0]);
-	return;
-      }
-
-      close(pipe_fds[1]);
-
+    if (options[j].name == NULL) {
+      fprintf(stderr, "set: %s: invalid option name\n", words[i]);
+      status = 1;
     } else {
-      // first component of the command
-      if (strcmp(components[0], "<") == 0) {
-        int nwords = count_nwords(components);
-        if (nwords < 3) {
-          fprintf(stderr, "Invalid pipe\n");
-          return;
-        }
-      }
-
-      for (int j = 0; components[j]; j++) {
-        if (strcmp(components[j], "<") == 0 && j != 0) {
-          fprintf(stderr, "Invalid input redirection\n");
-          return;
-        }
-        if (strcmp(components[j], ">") == 0) {
-          fprintf(stderr, "Invalid output redirection\n");
-          return;
-        }
-
-      }
-
-      if (is_input_redirection(components)) {
-
-	int input_file = open(components[1], O_RDONLY);
-
-        // read from the read end of the pipe instead of stdin
-	if (posix_spawn_file_actions_adddup2(&actions, input_file, 0) != 0) {
-	  perror("posix_spawn_file_actions_adddup2");
-	  return;
-	}
-
-	char executable_path[PATH_MAX];
-	executable_exists(path, components[2], executable_path); // haven't check if path exists
-
-	pid_t pid;
-	if (posix_spawn(&pid, executable_path, &actions, NULL, &components[2], environ)) {
-	  fprintf(stderr, "%s: command not found\n", components[2]);
-	  return;
-	}
-
-        close(pipe_fds[1]);
-
-      } else {
-
-	char executable_path[PATH_MAX];
-	executable_exists(path, components[0], executable_path);
-
-        posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
-
-	pid_t pid;
-	if (posix_spawn(&pid, executable_path, &actions, NULL, components, environ)) {
-	  fprintf(stderr, "%s: command not found\n", components[0]);
-	  return;
-	}
-        close(pipe_fds[1]);
-      }
-
+      *options[j].value = value;
     }
-
-    prev_read_pipe = pipe_fds[0];
-    i++;
-
   }
+  return status;
+}
 
-  // last component of the command
-  char **components = tokenize(commands[i], WORD_SEPARATORS, SPECIAL_CHARS);
 
-  int pipe_fds[2];
-  if (pipe(pipe_fds) == -1) {
-    perror("pipe");
+//
+// Implement the 'hash' shell built-in, which manages the table of
+// remembered program locations.
+//
+// Synopsis: hash [-r] [-d name...] [name...]
+// Examples:
+//     % hash
+//     % hash -r
+//     % hash ls grep
+//
+static void do_hash(char **words, char **path) {
+  if (words[1] == NULL) {
+    hash_print();
     return;
   }
 
-  posix_spawn_file_actions_t actions;
-  if (posix_spawn_file_actions_init(&actions) != 0) {
-    perror("posix_spawn_file_actions_init");
-    return;
+  int i = 1;
+  if (strcmp(words[i], "-r") == 0) {
+    hash_clear();
+    exec_cache_clear();
+    i++;
   }
 
-  // connect child process stdout to the write side of the child process pipe.
-  if (posix_spawn_file_actions_adddup2(&actions, prev_read_pipe, 0)) {
-    perror("posix_spawn_file_actions_adddup2");
+  if (words[i] != NULL && strcmp(words[i], "-d") == 0) {
+    for (i++; words[i] != NULL; i++) {
+      if (!hash_remove(words[i])) {
+        fprintf(stderr, "hash: %s: not found\n", words[i]);
+      }
+    }
+    return;
   }
 
-  if (posix_spawn_file_actions_addclose(&actions, pipe_fds[1])) {
-    perror("posix_spawn_file_actions_addclose");
+  // look up the remaining names so they're hashed before being used.
+  for (; words[i] != NULL; i++) {
+    char executable_path[PATH_MAX];
+    if (strchr(words[i], '/') != NULL) continue;
+    if (!executable_exists(path, words[i], executable_path)) {
+      fprintf(stderr, "hash: %s: not found\n", words[i]);
+    }
   }
+}
 
-  if (is_redirection(components)) {
-    if (is_valid_redirection_position(components) &&
-        is_valid_redirection_program(components)) {
 
-      int fd;
-      int nwords = count_nwords(components);
+// handle any command contains at least one '|' in it.
+// Every stage is resolved first, then all of them are spawned back to
+// back as a job and all of them are waited for, unless it runs in the
+// background. Returns the exit status of the last stage, the status of
+// each stage is kept for 'pipestatus'.
+static int piping(struct pipeline *pipeline, char **path, char **environ,
+                  bool background) {
+  uint64_t pipeline_traced = trace_begin();
+  int nstages = pipeline->nstages;
+  char **components[nstages];
+  char *executable_paths[nstages];
+  struct builtin *builtins[nstages];
+  int statuses[nstages];
+
+  for (int i = 0; i < nstages; i++) {
+    struct stage *stage = &pipeline->stages[i];
+    uint64_t started = metrics_clock();
+    uint64_t traced = trace_begin();
+    components[i] = globbing(stage->argv);
+    add_phase_time(PHASE_GLOB, started);
+    trace_end("glob", traced, stage->argv[0]);
+    executable_paths[i] = NULL;
+    builtins[i] = NULL;
+
+    started = metrics_clock();
+    traced = trace_begin();
+    // utilities of the shell run in a child of their own, which the
+    // pipes connect like a program.
+    char executable_path[PATH_MAX];
+    if (stage->argc == 0) {
+      fprintf(stderr, "Invalid null command\n");
+    } else if ((builtins[i] = find_builtin(components[i])) != NULL) {
+      executable_paths[i] = components[i][0];
+    } else if (find_program(path, components[i][0], executable_path)) {
+      executable_paths[i] = arena_strdup(&command_arena, executable_path);
+    }
+    add_phase_time(PHASE_LOOKUP, started);
+    trace_end("lookup", traced, components[i][0]);
+  }
 
-      if (is_output_write_redirection(components)) {
-	fd = open(components[nwords-1], O_CREAT|O_WRONLY|O_TRUNC, 0644);
+  fflush(stdout);
 
-      } else if (is_output_append_redirection(components)) {
-        fd = open(components[nwords-1], O_CREAT|O_WRONLY|O_APPEND, 0644);
+  struct job *job = create_job(pipeline->stages, nstages);
 
-      } else {
-        fd = -1;
-      }
-      if (fd == -1) {
-	perror(components[nwords-1]);
-	return;
-      }
-      if (posix_spawn_file_actions_adddup2(&actions, fd, 1)) {
-	perror("posix_spawn_file_actions_adddup2");
+  // the pipes are close-on-exec, a child only keeps the ends connected
+  // to its stdin and stdout, and the parent closes each end as soon as
+  // the child using it is spawned.
+  int prev_read_pipe = -1;
+  for (int i = 0; i < nstages; i++) {
+    int pipe_fds[2] = { -1, -1 };
+
+    if (i != nstages - 1 && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+      perror("pipe2");
+      // the rest of the pipeline can't be connected.
+      for (; i < nstages; i++) {
+        add_process(job, -1, executable_paths[i], 127);
       }
-      // construct the arguments array for posix_spawn
-      components = get_args_for_output_redirection(components);
-    } else {
-      return;
+      break;
     }
-  }
 
+    pid_t pid = -1;
+    if (executable_paths[i] != NULL) {
+      struct spawn_group group;
+      pid = spawn_program(components[i], executable_paths[i], builtins[i],
+                          &pipeline->stages[i], prev_read_pipe, pipe_fds[1],
+                          get_spawn_group(job, !background, &group), environ);
+    }
+    add_process(job, pid, executable_paths[i],
+                (executable_paths[i] == NULL) ? 127 : 1);
 
-  char executable_path[PATH_MAX];
-  executable_exists(path, components[0], executable_path); // haven't check if path exists
-  pid_t pid;
-  if (posix_spawn(&pid, executable_path, &actions, NULL, components, environ)) {
-    fprintf(stderr, "%s: command not found\n", components[0]);
-    return;
+    if (prev_read_pipe != -1) {
+      close(prev_read_pipe);
+    }
+    if (pipe_fds[1] != -1) {
+      close(pipe_fds[1]);
+    }
+    prev_read_pipe = pipe_fds[0];
   }
-  close(pipe_fds[1]);
 
-  int status;
-  if (waitpid(pid, &status, 0) == -1) {
-    perror("waitpid");
+  if (prev_read_pipe != -1) {
+    close(prev_read_pipe);
   }
 
-  if (WIFEXITED(status)) {
-    const int exit_status = WEXITSTATUS(status);
-    fprintf(stdout, "%s exit status = %d\n", executable_path, exit_status);
+  if (background) {
+    put_job_in_background(job);
+    memset(statuses, 0, sizeof(statuses));
+  } else {
+    uint64_t traced = trace_begin();
+    wait_for_job(job, statuses);
+    trace_end("wait", traced, NULL);
   }
+
+  record_pipe_status(statuses, nstages);
+  trace_end("pipeline", pipeline_traced, NULL);
+  return statuses[nstages - 1];
 }
 
 
 // join an array of strings into a single string, delimited by space.
+// the string is allocated from the command arena.
 static char *get_single_string(char **tokens) {
-  char *command = strdup(tokens[0]);
+  // enough space for every string followed by a space or NULL character.
+  size_t size = 0;
+  for (int i = 0; tokens[i] != NULL; i++) {
+    size += strlen(tokens[i]) + 1;
+  }
+  char *command = arena_alloc(&command_arena, size);
 
+  char *end = stpcpy(command, tokens[0]);
   for (int i = 1; tokens[i] != NULL; i++) {
-    // enough space for two strings and a space and NULL character.
-    int size = strlen(command) + strlen(tokens[i]) + 2;
-    command = realloc(command, size * sizeof(char));
-    strcat(command, " ");
-    strncat(command, tokens[i], strlen(tokens[i]));
+    *end++ = ' ';
+    end = stpcpy(end, tokens[i]);
   }
   return command;
 }
@@ -542,59 +775,149 @@ static void construct_absolute_path(char *path, char *program, char *executable_
 }
 
 
-// given a path to the command, arguments array of the command and environ,
-// executes the command.
-static int execute_executable(char **command_argv, char *path, char **environ) {
-  pid_t pid;
-  if (posix_spawn(&pid, path, NULL, NULL, command_argv, environ)) {
-    fprintf(stderr, "%s: command not found\n", command_argv[0]);
-    return 1;
+// Saves the path to run 'program' by into 'executable_path', searching
+// 'path' for it unless it's a pathname. Returns false and prints a
+// message if there's no such executable.
+static int find_program(char **path, char *program, char *executable_path) {
+  if (strchr(program, '/') == NULL) {
+    if (executable_exists(path, program, executable_path)) {
+      return true;
+    }
+
+  } else if (is_executable(program)) {
+    snprintf(executable_path, PATH_MAX, "%s", program);
+    return true;
   }
 
-  int status;
-  if (waitpid(pid, &status, 0) == -1) {
-    perror("waitpid");
-    return 1;
+  fprintf(stderr, "%s: command not found\n", program);
+  return false;
+}
+
+
+// given a path to the command, arguments array of the command, the
+// stage it comes from and environ, executes the command with the
+// redirections of the stage as a job of its own, or 'builtin' in a
+// child of the shell if it isn't NULL. Returns its exit status, or 0 if
+// it runs in the background.
+static int execute_executable(char **command_argv, char *path,
+                              struct builtin *builtin, struct stage *stage,
+                              char **environ, bool background) {
+  // output of builtins still buffered must come before the program's.
+  fflush(stdout);
+
+  struct job *job = create_job(stage, 1);
+  struct spawn_group group;
+  pid_t pid = spawn_program(command_argv, path, builtin, stage, -1, -1,
+                            get_spawn_group(job, !background, &group),
+                            environ);
+  add_process(job, pid, path, 127);
+
+  if (background && pid != -1) {
+    put_job_in_background(job);
+    return 0;
   }
+  uint64_t traced = trace_begin();
+  int status = wait_for_job(job, NULL);
+  trace_end("wait", traced, command_argv[0]);
+  return status;
+}
 
-  if (WIFEXITED(status)) {
-    const int exit_status = WEXITSTATUS(status);
-    fprintf(stdout, "%s exit status = %d\n", path, exit_status);
+
+// Spawn the program at 'path', or 'builtin' in a child of the shell if
+// it isn't NULL, with the redirections of 'stage' in 'group', its stdin
+// and stdout are connected to 'input_fd' and 'output_fd' first unless
+// they're -1. Returns the pid, or -1 if it couldn't be spawned.
+static pid_t spawn_program(char **command_argv, char *path,
+                           struct builtin *builtin, struct stage *stage,
+                           int input_fd, int output_fd,
+                           struct spawn_group *group, char **environ) {
+  uint64_t started = metrics_clock();
+  uint64_t traced = trace_begin();
+  struct fd_action actions[stage->nredirections + 2];
+  int nactions = 0;
+  if (input_fd != -1) {
+    actions[nactions++] = (struct fd_action){ input_fd, 0 };
   }
-  
-  return 0;
+  if (output_fd != -1) {
+    actions[nactions++] = (struct fd_action){ output_fd, 1 };
+  }
+
+  // redirections of the stage take over from the pipes.
+  int fds[stage->nredirections + 1];
+  if (open_redirections(stage->redirections, stage->nredirections,
+                        &actions[nactions], fds) == -1) {
+    return -1;
+  }
+  nactions += stage->nredirections;
+
+  pid_t pid;
+  if (builtin != NULL) {
+    pid = spawn_builtin(builtin, command_argv, actions, nactions, group);
+  } else {
+    pid = exec_cache_spawn(path, command_argv, environ, actions, nactions,
+                           group);
+  }
+  if (pid == -1 && (errno == E2BIG || builtin != NULL)) {
+    // a pattern like '**' can match more files than fit in argv.
+    fprintf(stderr, "%s: %s\n", command_argv[0], strerror(errno));
+  } else if (pid == -1) {
+    fprintf(stderr, "%s: command not found\n", command_argv[0]);
+  }
+
+  close_redirection_fds(fds, stage->nredirections);
+  add_phase_time(PHASE_SPAWN, started);
+  trace_end("spawn", traced, command_argv[0]);
+  return pid;
 }
 
 
-// print and execute the command in the .cowrie_history file.
-static void print_and_execute_past_command(char *asciiNumber, char **path, char **environment) {
-  FILE *fp = fopen(get_history_path(), "r");
-  if (fp != NULL) {
+// Save the exit status of every stage of the last pipeline.
+static void record_pipe_status(int *statuses, int nstatuses) {
+  if (nstatuses > pipe_status_size) {
+    pipe_status_size = nstatuses;
+    pipe_status = realloc(pipe_status, sizeof(*pipe_status) * pipe_status_size);
+  }
+  memcpy(pipe_status, statuses, sizeof(*pipe_status) * nstatuses);
+  npipe_status = nstatuses;
+}
 
-    int n;
-    if (asciiNumber != NULL) {
-      n = atoi(asciiNumber);
-    } else {
-      n = get_nlines() - 1;
-    }
 
-    char buffer[2048];
-    for (int i = 0; fgets(buffer, 2048, fp) != NULL; i++) {
-      if (i == n) {
-	printf("%s", buffer);
+//
+// Implement the 'pipestatus' shell built-in, which prints the exit
+// status of every stage of the last pipeline.
+//
+static void print_pipe_status() {
+  for (int i = 0; i < npipe_status; i++) {
+    printf(i == 0 ? "%d" : " %d", pipe_status[i]);
+  }
+  printf("\n");
+}
 
-	char **command_words = tokenize(buffer, WORD_SEPARATORS,
-					SPECIAL_CHARS);
 
-	execute_command(command_words, path, environment);
+// print and execute the command in the .cowrie_history file.
+// Returns the exit status of the command.
+static int print_and_execute_past_command(char *asciiNumber, char **path, char **environment) {
+  int n;
+  if (asciiNumber != NULL) {
+    n = atoi(asciiNumber);
+  } else {
+    n = get_nlines() - 1;
+  }
 
-	fclose(fp);
-	return;
-      }
-    }
-    fclose(fp);
+  int len;
+  char *entry = get_history_entry(n, &len);
+  if (entry == NULL) {
+    fprintf(stderr, "!: invalid history reference\n");
+    return 1;
   }
-  fprintf(stderr, "!: invalid history reference\n");
+
+  char *buffer = arena_strndup(&command_arena, entry, len);
+  printf("%s", buffer);
+
+  char **command_words = tokenize(&command_arena, buffer, WORD_SEPARATORS,
+                                  SPECIAL_CHARS);
+  // the bodies of its here-documents weren't kept.
+  return execute_command(command_words, path, environment, NULL);
 }
 
 
@@ -613,68 +936,3 @@ static int is_executable(char *pathname) {
   // can we execute it?
   faccessat(AT_FDCWD, pathname, X_OK, AT_EACCESS) == 0;
 }
-
-
-//
-// Split a string 's' into pieces by any one of a set of separators.
-//
-// Returns an array of strings, with the last element being 'NULL';
-// The array itself, and the strings, are allocated with 'malloc(3)';
-// the provided 'free_token' function can deallocate this.
-//
-static char **tokenize(char *s, char *separators, char *special_chars) {
-  size_t n_tokens = 0;
-  // malloc array guaranteed to be big enough
-  char **tokens = malloc((strlen(s) + 1) * sizeof *tokens);
-
-  while (*s != '\0') {
-    // We are pointing at zero or more of any of the separators.
-    // Skip leading instances of the separators.
-    s += strspn(s, separators);
-
-    // Now, 's' points at one or more characters we want to keep.
-    // The number of non-separator characters is the token length.
-    //
-    // Trailing separators after the last token mean that, at this
-    // point, we are looking at the end of the string, so:
-    if (*s == '\0') {
-      break;
-    }
-
-    size_t token_length = strcspn(s, separators);
-    size_t token_length_without_special_chars = strcspn(s, special_chars);
-
-    if (token_length_without_special_chars == 0) {
-      token_length_without_special_chars = 1;
-    }
-
-    if (token_length_without_special_chars < token_length) {
-      token_length = token_length_without_special_chars;
-    }
-
-    char *token = strndup(s, token_length);
-    assert(token != NULL);
-    s += token_length;
-
-    // Add this token.
-    tokens[n_tokens] = token;
-    n_tokens++;
-  }
-
-  tokens[n_tokens] = NULL;
-  // shrink array to correct size
-  tokens = realloc(tokens, (n_tokens + 1) * sizeof *tokens);
-
-  return tokens;
-}
-
-
-//
-// Free an array of strings as returned by 'tokenize'.
-//
-static void free_tokens(char **tokens) {
-  for (int i = 0; tokens[i] != NULL; i++) {
-    free(tokens[i]);
-  }
-  free(tokens);
-}
@@ -1,3 +1,15 @@
+#include <stdbool.h>
+
 // Returns true if the path contains an executable.
 // if true, save the path into 'executable_path'.
 int executable_exists(char **path, char *program, char *executable_path);
+
+
+// print the exit status of every program that finishes.
+extern bool show_exit_status;
+
+
+// Prints the exit status of a program that has finished if the shell
+// was asked to, 'status' is as returned by 'waitpid'. Returns the exit
+// status, or 128 plus the signal number if it was killed by a signal.
+int report_exit_status(char *path, int status);
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "history.h"
+#include "suggest.h"
+
+#define INITIAL_NNODES 4096
+
+
+// A node of the radix tree. The edge to it is labelled with 'len'
+// characters of the entry 'entry' from 'start', which are kept in the
+// history rather than copied; its children start with different
+// characters.
+struct node {
+  int entry;
+  int start;
+  int len;
+  // the newest entry which goes through the node, and the newest which
+  // goes on past it, -1 if none does.
+  int newest;
+  int newest_longer;
+  // indexes of the first child and of the next sibling, 0 if none.
+  int child;
+  int sibling;
+};
+
+
+static void add_entry(int n);
+static int add_node(int entry, int start, int len);
+static char *get_text(int entry, int *len);
+
+// the root is node 0, the tree is built when it has one.
+static struct node *nodes;
+static int nnodes;
+static int nodes_size;
+
+// the entries of the history in the tree.
+static int nindexed;
+
+
+char *suggest(char *prefix, size_t len, int *entry_len) {
+  if (len == 0) {
+    return NULL;
+  }
+  if (nnodes == 0) {
+    nodes_size = INITIAL_NNODES;
+    nodes = malloc(sizeof(*nodes) * nodes_size);
+    add_node(-1, 0, 0);
+  }
+  update_suggestions();
+
+  // follow the prefix down the tree, it may end inside an edge.
+  int node = 0;
+  size_t i = 0;
+  bool inside_edge = false;
+  while (i < len) {
+    int child = nodes[node].child;
+    while (child != 0 &&
+           get_text(nodes[child].entry, NULL)[nodes[child].start] != prefix[i]) {
+      child = nodes[child].sibling;
+    }
+    if (child == 0) {
+      return NULL;
+    }
+    char *label = &get_text(nodes[child].entry, NULL)[nodes[child].start];
+    int k = 0;
+    for (; k < nodes[child].len && i < len; k++, i++) {
+      if (label[k] != prefix[i]) {
+        return NULL;
+      }
+    }
+    inside_edge = (k < nodes[child].len);
+    node = child;
+  }
+
+  // an entry ending where the prefix does is the prefix itself, every
+  // entry ends at a node.
+  int newest = inside_edge ? nodes[node].newest : nodes[node].newest_longer;
+  if (newest == -1) {
+    return NULL;
+  }
+  return get_text(newest, entry_len);
+}
+
+
+void update_suggestions() {
+  if (nnodes == 0) {
+    return;
+  }
+  int nlines = get_nlines();
+  while (nindexed < nlines) {
+    add_entry(nindexed++);
+  }
+}
+
+
+// Add the entry 'n' of the history to the tree, it's newer than every
+// entry already there.
+static void add_entry(int n) {
+  int len;
+  char *text = get_text(n, &len);
+  int node = 0;
+  int i = 0;
+  nodes[node].newest = n;
+  if (len > 0) {
+    nodes[node].newest_longer = n;
+  }
+  while (i < len) {
+    int previous = 0;
+    int child = nodes[node].child;
+    while (child != 0 &&
+           get_text(nodes[child].entry, NULL)[nodes[child].start] != text[i]) {
+      previous = child;
+      child = nodes[child].sibling;
+    }
+
+    if (child == 0) {
+      // the rest of the entry is a new leaf.
+      int leaf = add_node(n, i, len - i);
+      nodes[leaf].sibling = nodes[node].child;
+      nodes[node].child = leaf;
+      return;
+    }
+
+    char *label = &get_text(nodes[child].entry, NULL)[nodes[child].start];
+    int k = 0;
+    while (k < nodes[child].len && i + k < len && label[k] == text[i + k]) {
+      k++;
+    }
+    if (k < nodes[child].len) {
+      // the entry leaves the edge part of the way, split it there.
+      int middle = add_node(nodes[child].entry, nodes[child].start, k);
+      nodes[middle].newest_longer = nodes[child].newest;
+      nodes[middle].child = child;
+      nodes[middle].sibling = nodes[child].sibling;
+      nodes[child].sibling = 0;
+      nodes[child].start += k;
+      nodes[child].len -= k;
+      if (previous == 0) {
+        nodes[node].child = middle;
+      } else {
+        nodes[previous].sibling = middle;
+      }
+      child = middle;
+    }
+    nodes[child].newest = n;
+    if (i + k < len) {
+      nodes[child].newest_longer = n;
+    }
+    node = child;
+    i += k;
+  }
+}
+
+
+// Returns the index of a new node for the edge labelled with 'len'
+// characters of 'entry' from 'start', with no children.
+static int add_node(int entry, int start, int len) {
+  if (nnodes == nodes_size) {
+    nodes_size *= 2;
+    nodes = realloc(nodes, sizeof(*nodes) * nodes_size);
+  }
+  struct node *node = &nodes[nnodes];
+  node->entry = entry;
+  node->start = start;
+  node->len = len;
+  node->newest = entry;
+  node->newest_longer = -1;
+  node->child = 0;
+  node->sibling = 0;
+  return nnodes++;
+}
+
+
+// Returns the text of the history entry 'entry', and saves its length
+// without the '\n' into 'len' unless it's NULL.
+static char *get_text(int entry, int *len) {
+  int entry_len;
+  char *text = get_history_entry(entry, &entry_len);
+  if (len != NULL) {
+    *len = (entry_len > 0 && text[entry_len-1] == '\n') ? entry_len - 1 : entry_len;
+  }
+  return text;
+}
@@ -0,0 +1,26 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+#include <stddef.h>
+
+//
+// Suggest how a line being typed goes on, from the newest entry of the
+// history which starts with it. The entries are kept in a radix tree,
+// built the first time a suggestion is asked for, in which every node
+// knows the newest entry below it and the newest which is longer than
+// the text leading to it, so a suggestion takes time
+// proportional to the length of the line whatever the size of the
+// history.
+//
+
+// Returns the newest entry of the history which starts with the 'len'
+// characters of 'prefix' and is longer, and saves its length, without
+// the '\n', into 'entry_len'. Returns NULL if there's none.
+char *suggest(char *prefix, size_t len, int *entry_len);
+
+
+// Add the entries appended to the history since they were last added
+// to the index, if it was built.
+void update_suggestions();
+
+#endif
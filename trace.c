@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// the number of events kept before they're written out.
+#define TRACE_RING_SIZE 4096
+// the longest detail kept with an event.
+#define TRACE_DETAIL_SIZE 64
+
+
+struct trace_event {
+  const char *name;
+  uint64_t started;
+  uint64_t duration;
+  char detail[TRACE_DETAIL_SIZE];
+};
+
+
+bool trace_perf = false;
+
+static struct trace_event ring[TRACE_RING_SIZE];
+static int nevents = 0;
+// the trace file, opened when the first events are written.
+static int trace_fd = -1;
+static bool trace_failed = false;
+// the shell which writes the trace, a forked child doesn't.
+static pid_t trace_pid = 0;
+static bool exit_handler_set = false;
+
+
+static void flush_events();
+static void finish_trace();
+static int open_trace();
+static void write_string(FILE *stream, const char *s);
+
+
+void init_trace() {
+  char *path = getenv("SIMSH_TRACE");
+  trace_perf = (path != NULL && path[0] != '\0');
+}
+
+
+uint64_t trace_begin() {
+  if (!trace_perf) {
+    return 0;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+void trace_end(const char *name, uint64_t started, const char *detail) {
+  if (started == 0) {
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (!exit_handler_set) {
+    exit_handler_set = true;
+    trace_pid = getpid();
+    atexit(finish_trace);
+  }
+
+  struct trace_event *event = &ring[nevents++];
+  event->name = name;
+  event->started = started;
+  event->duration = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - started;
+  event->detail[0] = '\0';
+  if (detail != NULL) {
+    strncpy(event->detail, detail, TRACE_DETAIL_SIZE - 1);
+    event->detail[TRACE_DETAIL_SIZE - 1] = '\0';
+  }
+
+  if (nevents == TRACE_RING_SIZE) {
+    flush_events();
+  }
+}
+
+
+// Write the events in the ring to the trace file in a single write, and
+// empty it. They're dropped if the file can't be written.
+static void flush_events() {
+  int n = nevents;
+  nevents = 0;
+  if (n == 0 || getpid() != trace_pid || open_trace() == -1) {
+    return;
+  }
+
+  char *buffer;
+  size_t size;
+  FILE *stream = open_memstream(&buffer, &size);
+  if (stream == NULL) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    struct trace_event *event = &ring[i];
+    fprintf(stream, "{\"name\":\"%s\",\"cat\":\"simsh\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+            event->name, event->started / 1e3, event->duration / 1e3,
+            trace_pid, trace_pid);
+    if (event->detail[0] != '\0') {
+      fprintf(stream, ",\"args\":{\"detail\":");
+      write_string(stream, event->detail);
+      fprintf(stream, "}");
+    }
+    fprintf(stream, "},\n");
+  }
+  fclose(stream);
+
+  for (size_t written = 0; written < size; ) {
+    ssize_t nwritten = write(trace_fd, buffer + written, size - written);
+    if (nwritten == -1 && errno == EINTR) {
+      continue;
+    }
+    if (nwritten == -1) {
+      break;
+    }
+    written += nwritten;
+  }
+  free(buffer);
+}
+
+
+// Write out the events left and end the trace, when the shell exits.
+static void finish_trace() {
+  flush_events();
+  if (trace_fd != -1 && getpid() == trace_pid) {
+    // names the process in the viewer, and ends the array.
+    dprintf(trace_fd, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                      "\"args\":{\"name\":\"simsh\"}}\n]\n", trace_pid);
+    close(trace_fd);
+    trace_fd = -1;
+  }
+}
+
+
+// Open the trace file and start the array of events if it isn't open
+// yet, returns -1 if it can't be.
+static int open_trace() {
+  if (trace_fd != -1 || trace_failed) {
+    return trace_fd;
+  }
+
+  char default_path[64];
+  char *path = getenv("SIMSH_TRACE");
+  if (path == NULL || path[0] == '\0') {
+    snprintf(default_path, sizeof(default_path), "simsh-%d.trace.json",
+             (int) trace_pid);
+    path = default_path;
+  }
+
+  trace_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  if (trace_fd == -1) {
+    fprintf(stderr, "trace: %s: %s\n", path, strerror(errno));
+    trace_failed = true;
+    return -1;
+  }
+  dprintf(trace_fd, "[\n");
+  return trace_fd;
+}
+
+
+// Print 's' as a JSON string.
+static void write_string(FILE *stream, const char *s) {
+  fputc('"', stream);
+  for (const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(stream, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(stream, "\\u%04x", *c);
+    } else {
+      fputc(*c, stream);
+    }
+  }
+  fputc('"', stream);
+}
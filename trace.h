@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Tracing of the steps the shell takes to run commands, in the trace
+// event format of Chrome, which Perfetto and chrome://tracing open.
+// It's turned on by setting SIMSH_TRACE to the file to write, or by
+// 'set -o trace-perf', which writes to SIMSH_TRACE or to
+// simsh-<pid>.trace.json. Events are kept in a ring in memory and
+// written out when it fills up and when the shell exits.
+//
+// A step is traced as:
+//
+//     uint64_t started = trace_begin();
+//     ...
+//     trace_end("glob", started, word);
+//
+
+
+// The steps are traced, changed by 'set -o trace-perf'.
+extern bool trace_perf;
+
+
+// Turn tracing on if SIMSH_TRACE is set.
+void init_trace();
+
+
+// Returns CLOCK_MONOTONIC in nanoseconds, or 0 if tracing is off.
+uint64_t trace_begin();
+
+
+// Record the step 'name', which started at 'started', a value of
+// 'trace_begin'. 'detail', which may be NULL, is shown along with it.
+// Nothing is recorded if 'started' is 0.
+void trace_end(const char *name, uint64_t started, const char *detail);
+
+#endif